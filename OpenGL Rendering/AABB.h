@@ -0,0 +1,149 @@
+#pragma once
+
+#include "float3.h"
+#include "float4x4.h"
+#include <float.h>
+
+// Axis aligned bounding box.
+class AABB
+{
+public:
+	float3 min;
+	float3 max;
+
+	// an empty box that any extend() replaces
+	AABB():min(FLT_MAX, FLT_MAX, FLT_MAX),max(-FLT_MAX, -FLT_MAX, -FLT_MAX){}
+
+	AABB(const float3& min, const float3& max):min(min),max(max){}
+
+	static AABB around(const float3& center, const float3& halfExtents)
+	{
+		return AABB(center - halfExtents, center + halfExtents);
+	}
+
+	bool isEmpty() const
+	{
+		return min.x > max.x;
+	}
+
+	void extend(const float3& p)
+	{
+		if(p.x < min.x) min.x = p.x;
+		if(p.y < min.y) min.y = p.y;
+		if(p.z < min.z) min.z = p.z;
+		if(p.x > max.x) max.x = p.x;
+		if(p.y > max.y) max.y = p.y;
+		if(p.z > max.z) max.z = p.z;
+	}
+
+	void extend(const AABB& b)
+	{
+		extend(b.min);
+		extend(b.max);
+	}
+
+	bool overlaps(const AABB& b) const
+	{
+		return min.x <= b.max.x && max.x >= b.min.x &&
+			min.y <= b.max.y && max.y >= b.min.y &&
+			min.z <= b.max.z && max.z >= b.min.z;
+	}
+
+	bool contains(const float3& p) const
+	{
+		return p.x >= min.x && p.x <= max.x &&
+			p.y >= min.y && p.y <= max.y &&
+			p.z >= min.z && p.z <= max.z;
+	}
+
+	float3 center() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	float3 halfExtents() const
+	{
+		return (max - min) * 0.5f;
+	}
+
+	float surfaceArea() const
+	{
+		float3 d = max - min;
+		return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	// closest point of the box to p
+	float3 clamp(const float3& p) const
+	{
+		return float3(
+			p.x < min.x ? min.x : (p.x > max.x ? max.x : p.x),
+			p.y < min.y ? min.y : (p.y > max.y ? max.y : p.y),
+			p.z < min.z ? min.z : (p.z > max.z ? max.z : p.z));
+	}
+
+	AABB expanded(float amount) const
+	{
+		float3 a(amount, amount, amount);
+		return AABB(min - a, max + a);
+	}
+
+	// Where the segment origin + t*delta, t in [0, 1], enters the box.
+	// Segments starting inside the box do not count as entering it.
+	bool intersectSegment(const float3& origin, const float3& delta, float& tEnter, float3& normal) const
+	{
+		float tMin = 0;
+		float tMax = 1;
+		int enterAxis = -1;
+		float enterSign = 0;
+		const float* o = &origin.x;
+		const float* d = &delta.x;
+		const float* lo = &min.x;
+		const float* hi = &max.x;
+		for(int axis = 0; axis < 3; axis++)
+		{
+			if(d[axis] == 0)
+			{
+				if(o[axis] < lo[axis] || o[axis] > hi[axis])
+					return false;
+				continue;
+			}
+			float oneOverD = 1.0f / d[axis];
+			float t0 = (lo[axis] - o[axis]) * oneOverD;
+			float t1 = (hi[axis] - o[axis]) * oneOverD;
+			float sign = -1;
+			if(t0 > t1)
+			{
+				float tmp = t0; t0 = t1; t1 = tmp;
+				sign = 1;
+			}
+			if(t0 > tMin)
+			{
+				tMin = t0;
+				enterAxis = axis;
+				enterSign = sign;
+			}
+			if(t1 < tMax)
+				tMax = t1;
+			if(tMin > tMax)
+				return false;
+		}
+		if(enterAxis < 0)
+			return false;
+		tEnter = tMin;
+		normal = float3(0, 0, 0);
+		(&normal.x)[enterAxis] = enterSign;
+		return true;
+	}
+
+	// box around this box after transformation by m
+	AABB transformed(const float4x4& m) const
+	{
+		float3 c = m.transformPoint(center());
+		float3 h = halfExtents();
+		float3 e(
+			fabsf(m.m[0]) * h.x + fabsf(m.m[4]) * h.y + fabsf(m.m[8]) * h.z,
+			fabsf(m.m[1]) * h.x + fabsf(m.m[5]) * h.y + fabsf(m.m[9]) * h.z,
+			fabsf(m.m[2]) * h.x + fabsf(m.m[6]) * h.y + fabsf(m.m[10]) * h.z);
+		return AABB(c - e, c + e);
+	}
+};
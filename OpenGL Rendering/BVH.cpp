@@ -0,0 +1,383 @@
+#include "BVH.h"
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+namespace
+{
+	const unsigned int MAX_LEAF_TRIANGLES = 4;
+	const int SAH_BINS = 12;
+	// traversal stack entries kept on the machine stack; deeper trees use the heap
+	const unsigned int LOCAL_STACK = 64;
+
+	struct BuildTask
+	{
+		unsigned int node;
+		unsigned int begin;
+		unsigned int end;
+		unsigned int depth;
+	};
+
+	struct Bin
+	{
+		AABB bounds;
+		unsigned int count;
+	};
+
+	float axisOf(const float3& v, int axis)
+	{
+		return (&v.x)[axis];
+	}
+}
+
+BVH::BVH(const std::vector<float3>& vertices):depth(0)
+{
+	build(vertices);
+}
+
+void BVH::build(const std::vector<float3>& vertices)
+{
+	unsigned int triangleCount = (unsigned int)(vertices.size() / 3);
+	if(triangleCount == 0)
+		return;
+	std::vector<AABB> triangleBounds(triangleCount);
+	std::vector<float3> centroids(triangleCount, float3(0, 0, 0));
+	std::vector<unsigned int> order(triangleCount);
+	for(unsigned int i = 0; i < triangleCount; i++)
+	{
+		triangleBounds[i].extend(vertices[i*3]);
+		triangleBounds[i].extend(vertices[i*3 + 1]);
+		triangleBounds[i].extend(vertices[i*3 + 2]);
+		centroids[i] = triangleBounds[i].center();
+		order[i] = i;
+	}
+
+	nodes.reserve(triangleCount * 2 / MAX_LEAF_TRIANGLES + 1);
+	packets.reserve(triangleCount / MAX_LEAF_TRIANGLES + 1);
+	nodes.push_back(Node());
+
+	std::vector<BuildTask> stack;
+	BuildTask root = {0, 0, triangleCount, 0};
+	stack.push_back(root);
+	while(!stack.empty())
+	{
+		BuildTask task = stack.back();
+		stack.pop_back();
+
+		AABB bounds;
+		AABB centroidBounds;
+		for(unsigned int i = task.begin; i < task.end; i++)
+		{
+			bounds.extend(triangleBounds[order[i]]);
+			centroidBounds.extend(centroids[order[i]]);
+		}
+		if(bounds.isEmpty())
+			bounds = AABB(float3(0, 0, 0), float3(0, 0, 0));
+		Node& node = nodes[task.node];
+		node.bmin[0] = bounds.min.x; node.bmin[1] = bounds.min.y; node.bmin[2] = bounds.min.z;
+		node.bmax[0] = bounds.max.x; node.bmax[1] = bounds.max.y; node.bmax[2] = bounds.max.z;
+
+		unsigned int count = task.end - task.begin;
+		if(count <= MAX_LEAF_TRIANGLES)
+		{
+			if(task.depth > depth)
+				depth = task.depth;
+			TrianglePacket p;
+			for(unsigned int lane = 0; lane < 4; lane++)
+			{
+				float3 v0(0, 0, 0), v1(0, 0, 0), v2(0, 0, 0);
+				unsigned int triangle = 0;
+				// unused lanes get a degenerate triangle that no ray hits
+				if(lane < count)
+				{
+					triangle = order[task.begin + lane];
+					v0 = vertices[triangle*3];
+					v1 = vertices[triangle*3 + 1];
+					v2 = vertices[triangle*3 + 2];
+				}
+				float3 e1 = v1 - v0;
+				float3 e2 = v2 - v0;
+				p.v0x[lane] = v0.x; p.v0y[lane] = v0.y; p.v0z[lane] = v0.z;
+				p.e1x[lane] = e1.x; p.e1y[lane] = e1.y; p.e1z[lane] = e1.z;
+				p.e2x[lane] = e2.x; p.e2y[lane] = e2.y; p.e2z[lane] = e2.z;
+				p.triangle[lane] = triangle;
+			}
+			node.leftFirst = (unsigned int)packets.size();
+			node.count = count;
+			packets.push_back(p);
+			continue;
+		}
+
+		// binned surface area heuristic over all three axes
+		int bestAxis = -1;
+		int bestSplit = 0;
+		float bestCost = FLT_MAX;
+		for(int axis = 0; axis < 3; axis++)
+		{
+			float lo = axisOf(centroidBounds.min, axis);
+			float hi = axisOf(centroidBounds.max, axis);
+			if(hi <= lo)
+				continue;
+			Bin bins[SAH_BINS];
+			for(int b = 0; b < SAH_BINS; b++)
+				bins[b].count = 0;
+			float scale = SAH_BINS / (hi - lo);
+			for(unsigned int i = task.begin; i < task.end; i++)
+			{
+				int b = (int)((axisOf(centroids[order[i]], axis) - lo) * scale);
+				if(b >= SAH_BINS) b = SAH_BINS - 1;
+				bins[b].bounds.extend(triangleBounds[order[i]]);
+				bins[b].count++;
+			}
+			// sweep from the right, then from the left
+			float rightArea[SAH_BINS];
+			unsigned int rightCount[SAH_BINS];
+			AABB accumulated;
+			unsigned int accumulatedCount = 0;
+			for(int b = SAH_BINS - 1; b > 0; b--)
+			{
+				accumulated.extend(bins[b].bounds);
+				accumulatedCount += bins[b].count;
+				rightArea[b] = accumulated.isEmpty() ? 0 : accumulated.surfaceArea();
+				rightCount[b] = accumulatedCount;
+			}
+			accumulated = AABB();
+			accumulatedCount = 0;
+			for(int b = 0; b < SAH_BINS - 1; b++)
+			{
+				accumulated.extend(bins[b].bounds);
+				accumulatedCount += bins[b].count;
+				if(accumulatedCount == 0 || rightCount[b + 1] == 0)
+					continue;
+				float cost = accumulated.surfaceArea() * accumulatedCount + rightArea[b + 1] * rightCount[b + 1];
+				if(cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		unsigned int mid;
+		if(bestAxis < 0)
+		{
+			// all centroids coincide: split the range in half
+			mid = task.begin + count / 2;
+		}
+		else
+		{
+			float lo = axisOf(centroidBounds.min, bestAxis);
+			float scale = SAH_BINS / (axisOf(centroidBounds.max, bestAxis) - lo);
+			unsigned int i = task.begin;
+			unsigned int j = task.end;
+			while(i < j)
+			{
+				int b = (int)((axisOf(centroids[order[i]], bestAxis) - lo) * scale);
+				if(b >= SAH_BINS) b = SAH_BINS - 1;
+				if(b <= bestSplit)
+					i++;
+				else
+					std::swap(order[i], order[--j]);
+			}
+			mid = i;
+		}
+
+		unsigned int left = (unsigned int)nodes.size();
+		nodes[task.node].leftFirst = left;
+		nodes[task.node].count = 0;
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+		BuildTask leftTask = {left, task.begin, mid, task.depth + 1};
+		BuildTask rightTask = {left + 1, mid, task.end, task.depth + 1};
+		stack.push_back(rightTask);
+		stack.push_back(leftTask);
+	}
+}
+
+// Moller-Trumbore against the four triangles of a packet. Updates tBest and
+// triangle if one of them is hit closer than tBest.
+bool BVH::intersectPacket(const TrianglePacket& p, unsigned int count,
+	const float3& origin, const float3& dir, float& tBest, unsigned int& triangle) const
+{
+	bool hit = false;
+#ifdef FLOAT3_SSE
+	__m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+	__m128 e1x = _mm_load_ps(p.e1x), e1y = _mm_load_ps(p.e1y), e1z = _mm_load_ps(p.e1z);
+	__m128 e2x = _mm_load_ps(p.e2x), e2y = _mm_load_ps(p.e2y), e2z = _mm_load_ps(p.e2z);
+
+	// pvec = dir x e2
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 valid = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	__m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_load_ps(p.v0x));
+	__m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_load_ps(p.v0y));
+	__m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_load_ps(p.v0z));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+	// qvec = tvec x e1
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+	__m128 zero = _mm_setzero_ps();
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(1e-6f)));
+	valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(tBest)));
+	int mask = _mm_movemask_ps(valid);
+	if(mask == 0)
+		return false;
+	float ts[4];
+	_mm_storeu_ps(ts, t);
+	for(unsigned int lane = 0; lane < count; lane++)
+	{
+		if((mask & (1 << lane)) && ts[lane] < tBest)
+		{
+			tBest = ts[lane];
+			triangle = p.triangle[lane];
+			hit = true;
+		}
+	}
+#else
+	for(unsigned int lane = 0; lane < count; lane++)
+	{
+		float3 e1(p.e1x[lane], p.e1y[lane], p.e1z[lane]);
+		float3 e2(p.e2x[lane], p.e2y[lane], p.e2z[lane]);
+		float3 pvec = dir.cross(e2);
+		float det = e1.dot(pvec);
+		if(fabsf(det) <= 1e-12f)
+			continue;
+		float invDet = 1.0f / det;
+		float3 tvec = origin - float3(p.v0x[lane], p.v0y[lane], p.v0z[lane]);
+		float u = tvec.dot(pvec) * invDet;
+		if(u < 0 || u > 1)
+			continue;
+		float3 qvec = tvec.cross(e1);
+		float v = dir.dot(qvec) * invDet;
+		if(v < 0 || u + v > 1)
+			continue;
+		float t = e2.dot(qvec) * invDet;
+		if(t > 1e-6f && t < tBest)
+		{
+			tBest = t;
+			triangle = p.triangle[lane];
+			hit = true;
+		}
+	}
+#endif
+	return hit;
+}
+
+bool BVH::traverse(const float3& origin, const float3& dir, float tMax, bool anyHit,
+	float& tHit, unsigned int& triangle) const
+{
+	if(nodes.empty() || packets.empty())
+		return false;
+
+	float3 invDir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+	float tBest = tMax;
+	bool hit = false;
+
+	// nearer children are visited at once, so at most one sibling per level waits
+	unsigned int local[LOCAL_STACK];
+	std::vector<unsigned int> deep;
+	unsigned int* stack = local;
+	if(depth + 1 > LOCAL_STACK)
+	{
+		deep.resize(depth + 1);
+		stack = &deep[0];
+	}
+	int top = 0;
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if(node.count > 0)
+		{
+			if(intersectPacket(packets[node.leftFirst], node.count, origin, dir, tBest, triangle))
+			{
+				hit = true;
+				if(anyHit)
+					break;
+			}
+			continue;
+		}
+
+		// visit the nearer child first
+		float tEnter[2];
+		bool entered[2];
+		for(int c = 0; c < 2; c++)
+		{
+			const Node& child = nodes[node.leftFirst + c];
+#ifdef FLOAT3_SSE
+			const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+			__m128 o = _mm_and_ps(xyz, origin.simd());
+			__m128 inv = _mm_and_ps(xyz, invDir.simd());
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(xyz, _mm_loadu_ps(child.bmin)), o), inv);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(xyz, _mm_loadu_ps(child.bmax)), o), inv);
+			__m128 tNear = _mm_min_ps(t0, t1);
+			__m128 tFar = _mm_max_ps(t0, t1);
+			// the unused fourth lane must not limit the interval
+			tNear = _mm_or_ps(_mm_and_ps(xyz, tNear), _mm_andnot_ps(xyz, _mm_setzero_ps()));
+			tFar = _mm_or_ps(_mm_and_ps(xyz, tFar), _mm_andnot_ps(xyz, _mm_set1_ps(FLT_MAX)));
+			tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+			tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+			tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+			tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+			float n = _mm_cvtss_f32(tNear);
+			float f = _mm_cvtss_f32(tFar);
+#else
+			float n = 0;
+			float f = FLT_MAX;
+			for(int axis = 0; axis < 3; axis++)
+			{
+				float t0 = (child.bmin[axis] - axisOf(origin, axis)) * axisOf(invDir, axis);
+				float t1 = (child.bmax[axis] - axisOf(origin, axis)) * axisOf(invDir, axis);
+				if(t0 > t1) std::swap(t0, t1);
+				if(t0 > n) n = t0;
+				if(t1 < f) f = t1;
+			}
+#endif
+			tEnter[c] = n;
+			entered[c] = n <= f && n < tBest;
+		}
+		int nearer = tEnter[1] < tEnter[0] ? 1 : 0;
+		if(entered[1 - nearer])
+			stack[top++] = node.leftFirst + 1 - nearer;
+		if(entered[nearer])
+			stack[top++] = node.leftFirst + nearer;
+	}
+	tHit = tBest;
+	return hit;
+}
+
+bool BVH::intersect(const float3& origin, const float3& dir, float tMax, Hit& hit) const
+{
+	return traverse(origin, dir, tMax, false, hit.t, hit.triangle);
+}
+
+bool BVH::occluded(const float3& origin, const float3& dir, float tMax) const
+{
+	float t;
+	unsigned int triangle;
+	return traverse(origin, dir, tMax, true, t, triangle);
+}
+
+AABB BVH::getBounds() const
+{
+	if(nodes.empty())
+		return AABB();
+	const Node& root = nodes[0];
+	return AABB(float3(root.bmin[0], root.bmin[1], root.bmin[2]),
+		float3(root.bmax[0], root.bmax[1], root.bmax[2]));
+}
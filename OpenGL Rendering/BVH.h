@@ -0,0 +1,62 @@
+#pragma once
+
+#include "float3.h"
+#include "AABB.h"
+#include <vector>
+
+// Bounding volume hierarchy over a triangle soup, for ray queries against
+// mesh geometry (picking, line of sight, height below a point).
+// Built with binned SAH splits; nodes are stored flattened in one array with
+// the two children of an inner node next to each other. Every leaf holds up to
+// four triangles packed for a 4-wide SIMD intersection test.
+class BVH
+{
+	struct Node
+	{
+		float bmin[3];
+		unsigned int leftFirst;	// inner node: index of left child; leaf: packet index
+		float bmax[3];
+		unsigned int count;		// triangles in the leaf packet, 0 for inner nodes
+	};
+
+	// four triangles as v0, edge1 = v1 - v0, edge2 = v2 - v0, one array per scalar
+	struct alignas(16) TrianglePacket
+	{
+		float v0x[4], v0y[4], v0z[4];
+		float e1x[4], e1y[4], e1z[4];
+		float e2x[4], e2y[4], e2z[4];
+		unsigned int triangle[4];	// index into the input triangles
+	};
+
+	std::vector<Node> nodes;
+	std::vector<TrianglePacket> packets;
+	unsigned int depth;		// of the deepest leaf, the root being at 0
+
+	void build(const std::vector<float3>& vertices);
+	bool intersectPacket(const TrianglePacket& p, unsigned int count,
+		const float3& origin, const float3& dir, float& tBest, unsigned int& triangle) const;
+	bool traverse(const float3& origin, const float3& dir, float tMax, bool anyHit,
+		float& tHit, unsigned int& triangle) const;
+public:
+	struct Hit
+	{
+		float t;				// the ray reached origin + t*dir
+		unsigned int triangle;	// index into the triangles the BVH was built from
+	};
+
+	// vertices holds three corners per triangle; with none, nothing is ever hit
+	BVH(const std::vector<float3>& vertices);
+
+	// closest hit along origin + t*dir with t in (0, tMax]; dir need not be unit length
+	bool intersect(const float3& origin, const float3& dir, float tMax, Hit& hit) const;
+
+	// whether anything lies along origin + t*dir with t in (0, tMax], for line of sight
+	bool occluded(const float3& origin, const float3& dir, float tMax) const;
+
+	AABB getBounds() const;
+
+	size_t getNodeCount() const
+	{
+		return nodes.size();
+	}
+};
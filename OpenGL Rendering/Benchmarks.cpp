@@ -0,0 +1,368 @@
+#include "Benchmarks.h"
+#include "float4x4.h"
+#include "Entities.h"
+#include "SpatialHash.h"
+#include "BVH.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// the simulation's fixed step
+	const double STEP = 1.0 / 120;
+
+	double millisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// results are summed into here, so the work cannot be optimized away
+	volatile float sink;
+
+	float checksum(const std::vector<float3>& points)
+	{
+		float sum = 0;
+		for(size_t i = 0; i < points.size(); i++)
+			sum += points[i].x + points[i].y + points[i].z;
+		return sum;
+	}
+
+	struct FlatGround
+	{
+		float heightAt(float, float) const
+		{
+			return 0;
+		}
+	};
+
+	// Moller-Trumbore, as the BVH's leaves do it
+	bool intersectTriangle(const float3& origin, const float3& dir,
+		const float3& v0, const float3& v1, const float3& v2, float& t)
+	{
+		float3 e1 = v1 - v0;
+		float3 e2 = v2 - v0;
+		float3 pvec = dir.cross(e2);
+		float det = e1.dot(pvec);
+		if(fabsf(det) <= 1e-12f)
+			return false;
+		float invDet = 1.0f / det;
+		float3 tvec = origin - v0;
+		float u = tvec.dot(pvec) * invDet;
+		if(u < 0 || u > 1)
+			return false;
+		float3 qvec = tvec.cross(e1);
+		float v = dir.dot(qvec) * invDet;
+		if(v < 0 || u + v > 1)
+			return false;
+		t = e2.dot(qvec) * invDet;
+		return t > 1e-6f;
+	}
+
+	float randomIn(float from, float to)
+	{
+		return from + (to - from) * rand() / RAND_MAX;
+	}
+
+	// count bodies steered like Tigger, scattered over the island
+	void addBodies(EntityWorld& world, int count)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			Entity e = world.create();
+			Transform transform = {float3(randomIn(-90, 90), randomIn(0, 5), randomIn(-90, 90)), randomIn(0, 360)};
+			Motion motion = {float3(randomIn(-10, 10), 0, randomIn(-10, 10)), float3(0, -10, 0), 0, 0, 0.5f, true};
+			world.bodies.add(e, transform, motion);
+			Controller controller = {10, 100, 10};
+			world.controllers.add(e, controller);
+		}
+	}
+}
+
+void benchmarkMath(const std::vector<float3>& vertices)
+{
+	const int PASSES = 200;
+	size_t count = vertices.size();
+	if(count == 0)
+		return;
+	std::vector<float3> out(vertices);
+	// a typical object's world matrix
+	float4x4 world = float4x4::translation(float3(3, 1, -2)) * float4x4::rotationY(30) *
+		float4x4::scaling(float3(0.2f, 0.2f, 0.2f));
+	const float* m = world.data();
+	double perVertex = 1e6 / ((double)PASSES * count);
+
+	printf("math over %u vertices, %d passes\n", (unsigned int)count, PASSES);
+	printf("%-22s  ns/vertex\n", "");
+
+	Clock::time_point start = Clock::now();
+	for(int pass = 0; pass < PASSES; pass++)
+		for(size_t i = 0; i < count; i++)
+		{
+			const float3& p = vertices[i];
+			out[i].x = m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12];
+			out[i].y = m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13];
+			out[i].z = m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14];
+		}
+	printf("%-22s  %9.3f\n", "scalar transform", millisecondsSince(start) * perVertex);
+	sink = checksum(out);
+
+	start = Clock::now();
+	for(int pass = 0; pass < PASSES; pass++)
+		for(size_t i = 0; i < count; i++)
+			out[i] = world.transformPoint(vertices[i]);
+	printf("%-22s  %9.3f\n", "transformPoint", millisecondsSince(start) * perVertex);
+	sink = checksum(out);
+
+	start = Clock::now();
+	for(int pass = 0; pass < PASSES; pass++)
+		world.transformPoints(&vertices[0], &out[0], count);
+	printf("%-22s  %9.3f\n", "transformPoints", millisecondsSince(start) * perVertex);
+	sink = checksum(out);
+
+	start = Clock::now();
+	for(int pass = 0; pass < PASSES; pass++)
+		for(size_t i = 0; i < count; i++)
+			out[i] = (vertices[i] + float3(0, 0, 1e-3f)).normalized();
+	printf("%-22s  %9.3f\n", "normalized", millisecondsSince(start) * perVertex);
+	sink = checksum(out);
+
+	// translate * rotate * scale, as Object builds its local matrix
+	start = Clock::now();
+	float sum = 0;
+	for(int pass = 0; pass < PASSES; pass++)
+		for(size_t i = 0; i < count; i++)
+		{
+			const float3& p = vertices[i];
+			float4x4 local = float4x4::translation(p) * float4x4::rotationY(p.x) * float4x4::scaling(float3(2, 2, 2));
+			sum += local.data()[12];
+		}
+	printf("%-22s  %9.3f  (per matrix)\n", "compose world matrix", millisecondsSince(start) * perVertex);
+	sink = sum;
+}
+
+void benchmarkEntities()
+{
+	const int STEPS = 20;
+	std::vector<bool> keys(256, false);
+	keys['w'] = true;
+	keys['a'] = true;
+	printf("%-10s %10s %10s\n", "entities", "ms/step", "ns/entity");
+	for(int count = 1000; count <= 100000; count *= 10)
+	{
+		EntityWorld world;
+		addBodies(world, count);
+		Clock::time_point start = Clock::now();
+		for(int step = 0; step < STEPS; step++)
+		{
+			controlSystem(world, keys);
+			motionSystem(world, STEP);
+			groundSystem(world, FlatGround());
+		}
+		double ms = millisecondsSince(start) / STEPS;
+		printf("%-10d %10.3f %10.2f\n", count, ms, ms * 1e6 / count);
+		sink = world.bodies.x[0];
+	}
+}
+
+void benchmarkCollectibles()
+{
+	const int COUNT = 100000;
+	const int QUERIES = 2000;
+	const float RADIUS = 5;
+	std::vector<float3> positions(COUNT);
+	SpatialHash grid(10);
+	for(int i = 0; i < COUNT; i++)
+	{
+		positions[i] = float3(randomIn(-500, 500), 0, randomIn(-500, 500));
+		grid.insert(i, positions[i], RADIUS);
+	}
+	// the player's path, one point a frame
+	std::vector<float3> path(QUERIES);
+	for(int i = 0; i < QUERIES; i++)
+		path[i] = float3(-400 + 0.4f * i, 0, 300 * sinf(0.01f * i));
+
+	printf("%d collectibles, %d queries\n", COUNT, QUERIES);
+	std::vector<unsigned int> hits;
+	size_t gridHits = 0;
+	Clock::time_point start = Clock::now();
+	for(int i = 0; i < QUERIES; i++)
+	{
+		hits.clear();
+		grid.query(path[i], hits);
+		gridHits += hits.size();
+	}
+	double gridTime = millisecondsSince(start);
+
+	size_t scanHits = 0;
+	start = Clock::now();
+	for(int i = 0; i < QUERIES; i++)
+	{
+		hits.clear();
+		const float3& p = path[i];
+		for(int k = 0; k < COUNT; k++)
+		{
+			float dx = positions[k].x - p.x;
+			float dz = positions[k].z - p.z;
+			if(dx*dx + dz*dz < RADIUS * RADIUS)
+				hits.push_back(k);
+		}
+		scanHits += hits.size();
+	}
+	double scanTime = millisecondsSince(start);
+
+	printf("%-12s %10s %8s\n", "", "us/query", "hits");
+	printf("%-12s %10.3f %8u\n", "spatial hash", gridTime * 1e3 / QUERIES, (unsigned int)gridHits);
+	printf("%-12s %10.3f %8u\n", "linear scan", scanTime * 1e3 / QUERIES, (unsigned int)scanHits);
+}
+
+void benchmarkIntegration()
+{
+	const int COUNT = 10000;
+	const int STEPS = 200;
+	EntityWorld batched;
+	srand(1);
+	addBodies(batched, COUNT);
+	EntityWorld single;
+	srand(1);
+	addBodies(single, COUNT);
+	float damping = (float)pow(0.8, STEP);
+
+	Clock::time_point start = Clock::now();
+	for(int step = 0; step < STEPS; step++)
+		motionSystem(batched, STEP);
+	double batchedTime = millisecondsSince(start);
+
+	start = Clock::now();
+	for(int step = 0; step < STEPS; step++)
+		for(size_t i = 0; i < single.bodies.size(); i++)
+			integrateBody(single.bodies, i, (float)STEP, damping);
+	double singleTime = millisecondsSince(start);
+
+	size_t mismatches = 0;
+	for(size_t i = 0; i < batched.bodies.size(); i++)
+		if(batched.bodies.x[i] != single.bodies.x[i] || batched.bodies.y[i] != single.bodies.y[i] ||
+			batched.bodies.z[i] != single.bodies.z[i])
+			mismatches++;
+
+	double bodies = (double)COUNT * STEPS;
+	printf("integration of %d bodies, %d steps\n", COUNT, STEPS);
+	printf("%-14s %14s\n", "", "Mbodies/s");
+	printf("%-14s %14.1f\n", "motionSystem", bodies / batchedTime * 1e-3);
+	printf("%-14s %14.1f\n", "integrateBody", bodies / singleTime * 1e-3);
+	printf("speedup %.2f, %u bodies differ\n", singleTime / batchedTime, (unsigned int)mismatches);
+	sink = batched.bodies.x[0] + single.bodies.x[0];
+}
+
+void benchmarkCollisions()
+{
+	const int STEPS = 20;
+	const float3 trees[] = {
+		float3(-50, 0, -70), float3(-60, 0, 40), float3(25, 0, 40),
+		float3(75, 0, -70), float3(-10, 0, -30) };
+	printf("%-10s %10s %10s %10s\n", "bodies", "pairs", "contacts", "ms/step");
+	for(int count = 1000; count <= 10000; count *= 10)
+	{
+		EntityWorld world;
+		for(const float3& spot : trees)
+		{
+			Entity e = world.create();
+			Transform transform = {spot, 0};
+			world.transforms.add(e, transform);
+			world.addCollider(e, Collider::box(float3(0, 10, 0), float3(1.5f, 10, 1.5f)));
+		}
+		addBodies(world, count);
+		for(size_t i = 0; i < world.bodies.size(); i++)
+			world.addCollider(world.bodies.ownerAt(i), Collider::sphere(float3(0, 0, 0), 0.5f));
+
+		std::vector<Entity> candidates;
+		std::vector<SweepAndPrune::Pair> pairs;
+		size_t pairSum = 0, contactSum = 0;
+		Clock::time_point start = Clock::now();
+		for(int step = 0; step < STEPS; step++)
+		{
+			motionSystem(world, STEP);
+			groundSystem(world, FlatGround());
+			continuousCollisionSystem(world, candidates);
+			CollisionStats stats = collisionSystem(world, pairs);
+			pairSum += stats.pairs;
+			contactSum += stats.contacts;
+		}
+		double ms = millisecondsSince(start) / STEPS;
+		printf("%-10d %10u %10u %10.3f\n", count, (unsigned int)(pairSum / STEPS),
+			(unsigned int)(contactSum / STEPS), ms);
+	}
+}
+
+void benchmarkRays(const std::vector<float3>& vertices)
+{
+	const int RAYS = 20000;
+	const int BRUTE_RAYS = 200;
+	const float T_MAX = 1e30f;
+	Clock::time_point start = Clock::now();
+	BVH bvh(vertices);
+	double buildTime = millisecondsSince(start);
+	AABB bounds = bvh.getBounds();
+	if(bounds.isEmpty())
+		return;
+	size_t triangles = vertices.size() / 3;
+
+	// from a sphere around the mesh to a point inside its bounds
+	float3 center = bounds.center();
+	float radius = (bounds.max - bounds.min).norm();
+	std::vector<float3> origins(RAYS);
+	std::vector<float3> dirs(RAYS);
+	srand(1);
+	for(int i = 0; i < RAYS; i++)
+	{
+		float3 away(randomIn(-1, 1), randomIn(-1, 1), randomIn(-1, 1));
+		origins[i] = center + away.normalized() * radius;
+		float3 target(randomIn(bounds.min.x, bounds.max.x), randomIn(bounds.min.y, bounds.max.y),
+			randomIn(bounds.min.z, bounds.max.z));
+		dirs[i] = target - origins[i];
+	}
+
+	std::vector<float> bvhT(RAYS);
+	int bvhHits = 0;
+	start = Clock::now();
+	for(int i = 0; i < RAYS; i++)
+	{
+		BVH::Hit hit;
+		bvhT[i] = bvh.intersect(origins[i], dirs[i], T_MAX, hit) ? hit.t : T_MAX;
+		bvhHits += bvhT[i] < T_MAX;
+	}
+	double bvhTime = millisecondsSince(start);
+
+	int occluded = 0;
+	start = Clock::now();
+	for(int i = 0; i < RAYS; i++)
+		occluded += bvh.occluded(origins[i], dirs[i], T_MAX);
+	double occludedTime = millisecondsSince(start);
+
+	int mismatches = 0;
+	start = Clock::now();
+	for(int i = 0; i < BRUTE_RAYS; i++)
+	{
+		float best = T_MAX;
+		for(size_t k = 0; k < triangles; k++)
+		{
+			float t;
+			if(intersectTriangle(origins[i], dirs[i], vertices[k*3], vertices[k*3 + 1], vertices[k*3 + 2], t) && t < best)
+				best = t;
+		}
+		if(fabsf(best - bvhT[i]) > 1e-4f * best)
+			mismatches++;
+	}
+	double bruteTime = millisecondsSince(start);
+
+	printf("rays against %u triangles, BVH of %u nodes built in %.1f ms\n", (unsigned int)triangles,
+		(unsigned int)bvh.getNodeCount(), buildTime);
+	printf("%-18s %12s %8s\n", "", "rays/s", "hit");
+	printf("%-18s %12.0f %7.0f%%\n", "BVH closest hit", RAYS / bvhTime * 1e3, 100.0 * bvhHits / RAYS);
+	printf("%-18s %12.0f %7.0f%%\n", "BVH any hit", RAYS / occludedTime * 1e3, 100.0 * occluded / RAYS);
+	printf("%-18s %12.0f\n", "every triangle", BRUTE_RAYS / bruteTime * 1e3);
+	printf("%d of %d rays differ from the BVH's\n", mismatches, BRUTE_RAYS);
+}
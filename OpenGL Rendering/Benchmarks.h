@@ -0,0 +1,36 @@
+#pragma once
+
+#include "float3.h"
+#include <vector>
+
+// Timings printed by the 'b' key, one table per subsystem. Each works on data
+// of its own, on the calling thread, so the scene is left as it was.
+
+// Transforms and normalizes vertices (three corners per triangle of a mesh)
+// over and over: with plain scalar code, one transformPoint at a time, and
+// batched through transformPoints. Also composes object world matrices.
+void benchmarkMath(const std::vector<float3>& vertices);
+
+// One simulation step of the control, motion and ground systems over 1000,
+// 10000 and 100000 steered bodies.
+void benchmarkEntities();
+
+// Finds the collectibles in reach of a walking player among 100000 spread
+// over a square kilometre, through the scene's SpatialHash and by testing
+// every one of them.
+void benchmarkCollectibles();
+
+// Integrates the same bodies with motionSystem, four at a time where SSE is
+// available, and with integrateBody one at a time, and checks that both end
+// up in the same place.
+void benchmarkIntegration();
+
+// Full collision steps, sweeps and broadphase and contacts, for 1000 and 10000
+// bouncing spheres among the island's trees, as 'x' spawns them: pairs and
+// contacts found, and time, per step.
+void benchmarkCollisions();
+
+// Casts rays from all around a mesh (three corners per triangle in vertices)
+// into its bounds, through a BVH and by testing every triangle, and checks
+// that both find the same hits.
+void benchmarkRays(const std::vector<float3>& vertices);
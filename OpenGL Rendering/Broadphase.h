@@ -0,0 +1,105 @@
+#pragma once
+
+#include "AABB.h"
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+// Sort and sweep broadphase along the x axis. Boxes are kept in an array
+// ordered by min.x; since bodies move little between steps, re-sorting that
+// array with insertion sort is close to linear. Pairs of static boxes are
+// never reported.
+class SweepAndPrune
+{
+    struct Proxy
+    {
+        unsigned int id;
+        AABB box;
+        bool isStatic;
+    };
+
+    std::vector<Proxy> proxies;
+    std::vector<unsigned int> freeProxies;
+    std::vector<unsigned int> order;    // live proxy handles by box.min.x
+
+    void sortOrder() {
+        for(size_t i = 1; i < order.size(); i++) {
+            unsigned int h = order[i];
+            float key = proxies[h].box.min.x;
+            size_t j = i;
+            while(j > 0 && proxies[order[j - 1]].box.min.x > key) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = h;
+        }
+    }
+public:
+    typedef std::pair<unsigned int, unsigned int> Pair;
+
+    // returns a handle for update and remove; id is what pairs report
+    unsigned int add(unsigned int id, const AABB& box, bool isStatic) {
+        Proxy p = {id, box, isStatic};
+        unsigned int h;
+        if(!freeProxies.empty()) {
+            h = freeProxies.back();
+            freeProxies.pop_back();
+            proxies[h] = p;
+        } else {
+            h = (unsigned int)proxies.size();
+            proxies.push_back(p);
+        }
+        // in place, as query relies on order being sorted
+        order.insert(std::upper_bound(order.begin(), order.end(), box.min.x,
+            [this](float key, unsigned int other) { return key < proxies[other].box.min.x; }), h);
+        return h;
+    }
+
+    void remove(unsigned int handle) {
+        for(size_t i = 0; i < order.size(); i++) {
+            if(order[i] == handle) {
+                order.erase(order.begin() + i);
+                break;
+            }
+        }
+        freeProxies.push_back(handle);
+    }
+
+    void update(unsigned int handle, const AABB& box) {
+        proxies[handle].box = box;
+    }
+
+    size_t size() const {
+        return order.size();
+    }
+
+    // Appends the ids of every box overlapping box to ids.
+    template<typename Container>
+    void query(const AABB& box, Container& ids) const {
+        for(size_t i = 0; i < order.size(); i++) {
+            const Proxy& p = proxies[order[i]];
+            if(p.box.min.x > box.max.x)
+                break;
+            if(p.box.overlaps(box))
+                ids.push_back(p.id);
+        }
+    }
+
+    // Appends the ids of every overlapping pair of boxes to pairs.
+    template<typename Container>
+    void findPairs(Container& pairs) {
+        sortOrder();
+        for(size_t i = 0; i < order.size(); i++) {
+            const Proxy& a = proxies[order[i]];
+            for(size_t j = i + 1; j < order.size(); j++) {
+                const Proxy& b = proxies[order[j]];
+                if(b.box.min.x > a.box.max.x)
+                    break;
+                if(a.isStatic && b.isStatic)
+                    continue;
+                if(a.box.overlaps(b.box))
+                    pairs.push_back(Pair(a.id, b.id));
+            }
+        }
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+// GLSL 1.20 sources of the deferred renderer. The geometry pass uses the
+// forward vertex shader and SHADOW_FUNCTIONS followed by
+// GBUFFER_FRAGMENT_SHADER to fill the GBuffer, looking up the sun's shadow
+// maps as it goes. The
+// lighting pass draws one quad over the screen with DEFERRED_VERTEX_SHADER
+// and SHADING_FUNCTIONS followed by DEFERRED_FRAGMENT_SHADER, so every
+// visible pixel is lit exactly once, however much geometry overlapped it.
+// The quad also writes the G-buffer's depth, so that transparent surfaces can
+// be drawn forward over the result.
+
+// after "#version 120" and SHADOW_FUNCTIONS
+const char* const GBUFFER_FRAGMENT_SHADER =
+	"uniform sampler2D uTexture;\n"
+	"uniform bool uTextured;\n"
+	"uniform bool uLit;\n"
+	"varying vec3 vWorldPos;\n"
+	"varying vec3 vWorldNormal;\n"
+	"varying float vViewDepth;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 texel = uTextured ? texture2D(uTexture, gl_TexCoord[0].st) : vec4(1.0);\n"
+	"	if(!uLit)\n"
+	"	{\n"
+	"		gl_FragData[0] = texel;\n"
+	"		gl_FragData[1] = vec4(0.0);\n"
+	"		gl_FragData[2] = vec4(0.0);\n"
+	"		return;\n"
+	"	}\n"
+	"	gl_FragData[0] = vec4(gl_FrontMaterial.diffuse.rgb * texel.rgb, gl_FrontMaterial.diffuse.a * texel.a);\n"
+	"	gl_FragData[1] = vec4(normalize(vWorldNormal), gl_FrontMaterial.shininess);\n"
+	"	gl_FragData[2] = vec4(gl_FrontMaterial.specular.rgb * texel.rgb, sunShadow(vWorldPos, vViewDepth));\n"
+	"}\n";
+
+const char* const DEFERRED_VERTEX_SHADER =
+	"#version 120\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = gl_Vertex;\n"
+	"}\n";
+
+const char* const DEFERRED_FRAGMENT_SHADER =
+	"uniform sampler2D uAlbedo;\n"
+	"uniform sampler2D uNormal;\n"
+	"uniform sampler2D uSpecular;\n"
+	"uniform sampler2D uDepth;\n"
+	"uniform vec2 uScreenSize;\n"
+	"uniform mat4 uView;\n"
+	"uniform mat4 uViewProjInverse;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 uv = gl_FragCoord.xy / uScreenSize;\n"
+	"	float depth = texture2D(uDepth, uv).r;\n"
+	"	if(depth == 1.0)\n"
+	"		discard;\n"
+	"	gl_FragDepth = depth;\n"
+	"	vec4 albedo = texture2D(uAlbedo, uv);\n"
+	"	vec4 normal = texture2D(uNormal, uv);\n"
+	"	if(dot(normal.xyz, normal.xyz) < 0.5)\n"
+	"	{\n"
+	"		gl_FragColor = albedo;\n"
+	"		return;\n"
+	"	}\n"
+	"	// back from window coordinates to the world\n"
+	"	vec4 world = uViewProjInverse * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);\n"
+	"	vec3 position = world.xyz / world.w;\n"
+	"	vec4 specular = texture2D(uSpecular, uv);\n"
+	"	vec3 n = normalize(normal.xyz);\n"
+	"	vec3 v = normalize(uViewInverse[3].xyz - position);\n"
+	"	vec3 color = ambient(albedo.rgb);\n"
+	"	color += shadeLights(position, n, v, albedo.rgb, specular.rgb, normal.w, specular.a);\n"
+	"	if(uClustered)\n"
+	"	{\n"
+	"		float viewDepth = -(uView * vec4(position, 1.0)).z;\n"
+	"		color += shadeClusters(position, viewDepth, n, v, albedo.rgb, specular.rgb, normal.w);\n"
+	"	}\n"
+	"	gl_FragColor = vec4(color, albedo.a);\n"
+	"}\n";
@@ -0,0 +1,675 @@
+#pragma once
+
+#include "float3.h"
+#include "quaternion.h"
+#include "SpatialHash.h"
+#include "Broadphase.h"
+#include <vector>
+
+class Object;
+
+// Entities are plain ids; their state lives in per-component arrays that the
+// systems below walk in tight loops, instead of in virtual Object methods.
+typedef unsigned int Entity;
+const Entity NO_ENTITY = 0xffffffff;
+
+// Dense storage for one component type. Components of live entities are kept
+// contiguous; removing one moves the last component into the hole.
+template<typename T>
+class ComponentArray
+{
+    std::vector<T> components;
+    std::vector<Entity> owners;
+    std::vector<unsigned int> slots;    // entity -> index into components, or NO_SLOT
+    enum { NO_SLOT = 0xffffffff };
+public:
+    T& add(Entity e, const T& component) {
+        if(e >= slots.size())
+            slots.resize(e + 1, NO_SLOT);
+        if(slots[e] != NO_SLOT)
+            return components[slots[e]] = component;
+        slots[e] = (unsigned int)components.size();
+        components.push_back(component);
+        owners.push_back(e);
+        return components.back();
+    }
+    void remove(Entity e) {
+        if(!has(e)) return;
+        unsigned int slot = slots[e];
+        unsigned int last = (unsigned int)components.size() - 1;
+        components[slot] = components[last];
+        owners[slot] = owners[last];
+        slots[owners[slot]] = slot;
+        components.pop_back();
+        owners.pop_back();
+        slots[e] = NO_SLOT;
+    }
+    bool has(Entity e) const {
+        return e < slots.size() && slots[e] != NO_SLOT;
+    }
+    T& get(Entity e) {
+        return components[slots[e]];
+    }
+    size_t size() const {
+        return components.size();
+    }
+    T& operator[](size_t i) {
+        return components[i];
+    }
+    Entity ownerAt(size_t i) const {
+        return owners[i];
+    }
+};
+
+// placement on the island; angle is in degrees about the y axis
+struct Transform
+{
+    float3 position;
+    float angle;
+};
+
+// Initial state of a body that is simulated every frame. Confined bodies
+// (Tigger) fall under the controller's acceleration, bounce off the ground and
+// stop at the island walls; the rest (the balloon) simply drift with their
+// velocity.
+struct Motion
+{
+    float3 velocity;
+    float3 acceleration;
+    float angularVelocity;
+    float angularAccel;
+    float restitution;
+    bool confined;
+};
+
+// Simulated bodies, stored as one array per scalar so that motionSystem can
+// integrate four of them per SIMD instruction. A body owns its transform:
+// entities in here have no Transform component.
+class Bodies
+{
+    std::vector<Entity> owners;
+    std::vector<unsigned int> slots;    // entity -> body index, or NO_SLOT
+    enum { NO_SLOT = 0xffffffff };
+public:
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> ax, ay, az;
+    std::vector<float> angle, angularVelocity, angularAccel;
+    std::vector<float> restitution;
+    std::vector<float> confined;        // 1 or 0
+    // transform before the last step, for render interpolation
+    std::vector<float> previousX, previousY, previousZ, previousAngle;
+
+    void add(Entity e, const Transform& t, const Motion& m) {
+        if(e >= slots.size())
+            slots.resize(e + 1, NO_SLOT);
+        if(slots[e] != NO_SLOT)
+            remove(e);
+        slots[e] = (unsigned int)owners.size();
+        owners.push_back(e);
+        x.push_back(t.position.x); y.push_back(t.position.y); z.push_back(t.position.z);
+        vx.push_back(m.velocity.x); vy.push_back(m.velocity.y); vz.push_back(m.velocity.z);
+        ax.push_back(m.acceleration.x); ay.push_back(m.acceleration.y); az.push_back(m.acceleration.z);
+        angle.push_back(t.angle);
+        angularVelocity.push_back(m.angularVelocity);
+        angularAccel.push_back(m.angularAccel);
+        restitution.push_back(m.restitution);
+        confined.push_back(m.confined ? 1.0f : 0.0f);
+        previousX.push_back(t.position.x); previousY.push_back(t.position.y); previousZ.push_back(t.position.z);
+        previousAngle.push_back(t.angle);
+    }
+    void remove(Entity e) {
+        if(!has(e)) return;
+        unsigned int i = slots[e];
+        unsigned int last = (unsigned int)owners.size() - 1;
+        std::vector<float>* columns[] = {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az,
+            &angle, &angularVelocity, &angularAccel, &restitution, &confined,
+            &previousX, &previousY, &previousZ, &previousAngle};
+        for(size_t c = 0; c < sizeof(columns) / sizeof(columns[0]); c++) {
+            (*columns[c])[i] = (*columns[c])[last];
+            columns[c]->pop_back();
+        }
+        owners[i] = owners[last];
+        slots[owners[i]] = i;
+        owners.pop_back();
+        slots[e] = NO_SLOT;
+    }
+    bool has(Entity e) const {
+        return e < slots.size() && slots[e] != NO_SLOT;
+    }
+    unsigned int slot(Entity e) const {
+        return slots[e];
+    }
+    size_t size() const {
+        return owners.size();
+    }
+    Entity ownerAt(size_t i) const {
+        return owners[i];
+    }
+    float3 position(size_t i) const {
+        return float3(x[i], y[i], z[i]);
+    }
+    float3 previousPosition(size_t i) const {
+        return float3(previousX[i], previousY[i], previousZ[i]);
+    }
+    void setVelocity(size_t i, const float3& v) {
+        vx[i] = v.x; vy[i] = v.y; vz[i] = v.z;
+    }
+    void setAcceleration(size_t i, const float3& a) {
+        ax[i] = a.x; ay[i] = a.y; az[i] = a.z;
+    }
+};
+
+// keyboard driven steering
+struct Controller
+{
+    float thrust;
+    float turnRate;
+    float gravity;
+};
+
+// can be picked up by walking within radius of it on the x/z plane
+struct Collectible
+{
+    float radius;
+};
+
+// Solid shape that bodies bump into: a sphere when radius > 0, otherwise a box
+// of halfExtents. It sits at offset from the entity's position. Colliders of
+// entities without a body are static obstacles.
+struct Collider
+{
+    float3 offset;
+    float3 halfExtents;
+    float radius;
+    unsigned int proxy;     // broadphase handle, assigned by EntityWorld::addCollider
+
+    static Collider sphere(const float3& offset, float radius) {
+        Collider c = {offset, float3(0, 0, 0), radius, 0};
+        return c;
+    }
+    static Collider box(const float3& offset, const float3& halfExtents) {
+        Collider c = {offset, halfExtents, 0, 0};
+        return c;
+    }
+};
+
+// what the last collisionSystem run found
+struct CollisionStats
+{
+    size_t proxies;
+    size_t pairs;
+    size_t contacts;
+};
+
+// the Object that draws this entity; moving entities push their transform into it
+struct Renderable
+{
+    Object* object;
+};
+
+class EntityWorld
+{
+    Entity nextEntity;
+    std::vector<Entity> freeEntities;
+public:
+    ComponentArray<Transform> transforms;
+    Bodies bodies;
+    ComponentArray<Controller> controllers;
+    ComponentArray<Collectible> collectibles;
+    ComponentArray<Renderable> renderables;
+    ComponentArray<Collider> colliders;
+    SweepAndPrune broadphase;
+
+    EntityWorld():nextEntity(0){}
+
+    Entity create() {
+        if(!freeEntities.empty()) {
+            Entity e = freeEntities.back();
+            freeEntities.pop_back();
+            return e;
+        }
+        return nextEntity++;
+    }
+    float3 positionOf(Entity e) {
+        if(bodies.has(e))
+            return bodies.position(bodies.slot(e));
+        return transforms.get(e).position;
+    }
+    AABB boundsOf(Entity e, const Collider& c) {
+        float3 center = positionOf(e) + c.offset;
+        if(c.radius > 0)
+            return AABB::around(center, float3(c.radius, c.radius, c.radius));
+        return AABB::around(center, c.halfExtents);
+    }
+    // give the entity its body or transform before its collider
+    void addCollider(Entity e, Collider c) {
+        if(colliders.has(e))
+            broadphase.remove(colliders.get(e).proxy);
+        c.proxy = broadphase.add(e, boundsOf(e, c), !bodies.has(e));
+        colliders.add(e, c);
+    }
+    void removeCollider(Entity e) {
+        if(!colliders.has(e)) return;
+        broadphase.remove(colliders.get(e).proxy);
+        colliders.remove(e);
+    }
+    void destroy(Entity e) {
+        if(colliders.has(e))
+            broadphase.remove(colliders.get(e).proxy);
+        colliders.remove(e);
+        transforms.remove(e);
+        bodies.remove(e);
+        controllers.remove(e);
+        collectibles.remove(e);
+        renderables.remove(e);
+        freeEntities.push_back(e);
+    }
+};
+
+// Turns held keys into accelerations for every controlled body.
+inline void controlSystem(EntityWorld& world, const std::vector<bool>& keysPressed)
+{
+    for(size_t i = 0; i < world.controllers.size(); i++) {
+        Entity e = world.controllers.ownerAt(i);
+        const Controller& c = world.controllers[i];
+        Bodies& b = world.bodies;
+        unsigned int body = b.slot(e);
+
+        if(keysPressed['a'] == true) {
+            b.angularAccel[body] = c.turnRate;
+        } else if (keysPressed['d'] == true) {
+            b.angularAccel[body] = -c.turnRate;
+        } else {
+            b.angularAccel[body] = 0;
+        }
+        // model space forward is -x, turned by the current heading
+        float3 forward = quaternion::fromAxisAngle(float3(0, 1, 0), b.angle[body])
+            .rotate(float3(-c.thrust, 0, 0));
+
+        if(keysPressed['w']) {
+            b.setAcceleration(body, forward + float3(0, -c.gravity, 0));
+        } else if (keysPressed['s']) {
+            b.setAcceleration(body, -forward + float3(0, -c.gravity, 0));
+        } else {
+            b.setAcceleration(body, float3(0, -c.gravity, 0));
+        }
+    }
+}
+
+// Island walls that confined bodies cannot leave.
+const float ISLAND_EXTENT = 99;
+
+// Integrates body i on its own. Used for the bodies left over after the SIMD
+// batches and on targets without SSE; both paths give the same results.
+inline void integrateBody(Bodies& b, size_t i, float dt, float damping)
+{
+    b.previousX[i] = b.x[i]; b.previousY[i] = b.y[i]; b.previousZ[i] = b.z[i];
+    b.previousAngle[i] = b.angle[i];
+
+    float3 pos(b.x[i], b.y[i], b.z[i]);
+    float3 vel(b.vx[i], b.vy[i], b.vz[i]);
+    float3 acc(b.ax[i], b.ay[i], b.az[i]);
+
+    if(b.confined[i] == 0) {
+        pos = pos + vel*dt;
+        b.x[i] = pos.x; b.y[i] = pos.y; b.z[i] = pos.z;
+        return;
+    }
+
+    // at a wall, only moves that lead back onto the island are allowed
+    float3 projPos = pos + vel*dt;
+    bool outside = true;
+    bool inward = false;
+    if(pos.x > ISLAND_EXTENT)
+        inward = projPos.x <= pos.x;
+    else if(pos.x < -ISLAND_EXTENT)
+        inward = projPos.x >= pos.x;
+    else if(pos.z > ISLAND_EXTENT)
+        inward = projPos.z <= pos.z;
+    else if(pos.z < -ISLAND_EXTENT)
+        inward = projPos.z >= pos.z;
+    else
+        outside = false;
+
+    if(!outside) {
+        vel = vel + acc*dt;
+        pos = pos + vel*dt;
+    } else if(inward) {
+        pos = projPos;
+        vel = vel + acc*dt;
+    } else {
+        vel = float3(0,0,0);
+    }
+    vel *= damping;
+
+    b.angularVelocity[i] = b.angularVelocity[i] + b.angularAccel[i]*dt;
+    b.angle[i] = b.angle[i] + b.angularVelocity[i]*dt;
+    b.angularVelocity[i] *= damping;
+
+    b.x[i] = pos.x; b.y[i] = pos.y; b.z[i] = pos.z;
+    b.vx[i] = vel.x; b.vy[i] = vel.y; b.vz[i] = vel.z;
+}
+
+#ifdef FLOAT3_SSE
+// lanes of mask ? a : b
+inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+// Integrates bodies [begin, end). The damping factor is computed once per
+// step, and the wall branches of integrateBody become lane masks. Bodies are
+// independent, so disjoint ranges may be integrated on different threads.
+inline void motionSystem(EntityWorld& world, double dt, size_t begin, size_t end)
+{
+    Bodies& b = world.bodies;
+    float fdt = (float)dt;
+    float damping = (float)pow(0.8, dt);
+    size_t count = end;
+    size_t i = begin;
+#ifdef FLOAT3_SSE
+    const __m128 vdt = _mm_set1_ps(fdt);
+    const __m128 vdamping = _mm_set1_ps(damping);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 extent = _mm_set1_ps(ISLAND_EXTENT);
+    const __m128 negExtent = _mm_set1_ps(-ISLAND_EXTENT);
+    for(; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(&b.x[i]), py = _mm_loadu_ps(&b.y[i]), pz = _mm_loadu_ps(&b.z[i]);
+        __m128 vx = _mm_loadu_ps(&b.vx[i]), vy = _mm_loadu_ps(&b.vy[i]), vz = _mm_loadu_ps(&b.vz[i]);
+        __m128 ax = _mm_loadu_ps(&b.ax[i]), ay = _mm_loadu_ps(&b.ay[i]), az = _mm_loadu_ps(&b.az[i]);
+        __m128 angle = _mm_loadu_ps(&b.angle[i]);
+        __m128 angVel = _mm_loadu_ps(&b.angularVelocity[i]);
+        __m128 confined = _mm_cmpneq_ps(_mm_loadu_ps(&b.confined[i]), zero);
+
+        _mm_storeu_ps(&b.previousX[i], px);
+        _mm_storeu_ps(&b.previousY[i], py);
+        _mm_storeu_ps(&b.previousZ[i], pz);
+        _mm_storeu_ps(&b.previousAngle[i], angle);
+
+        __m128 projX = _mm_add_ps(px, _mm_mul_ps(vx, vdt));
+        __m128 projY = _mm_add_ps(py, _mm_mul_ps(vy, vdt));
+        __m128 projZ = _mm_add_ps(pz, _mm_mul_ps(vz, vdt));
+
+        // which wall, if any, each body is beyond, in the order integrateBody tests them
+        __m128 outXp = _mm_cmpgt_ps(px, extent);
+        __m128 outXn = _mm_andnot_ps(outXp, _mm_cmplt_ps(px, negExtent));
+        __m128 outX = _mm_or_ps(outXp, outXn);
+        __m128 outZp = _mm_andnot_ps(outX, _mm_cmpgt_ps(pz, extent));
+        __m128 outZn = _mm_andnot_ps(_mm_or_ps(outX, outZp), _mm_cmplt_ps(pz, negExtent));
+        __m128 outside = _mm_or_ps(outX, _mm_or_ps(outZp, outZn));
+        __m128 inward = _mm_or_ps(
+            _mm_or_ps(_mm_and_ps(outXp, _mm_cmple_ps(projX, px)), _mm_and_ps(outXn, _mm_cmpge_ps(projX, px))),
+            _mm_or_ps(_mm_and_ps(outZp, _mm_cmple_ps(projZ, pz)), _mm_and_ps(outZn, _mm_cmpge_ps(projZ, pz))));
+
+        __m128 accVx = _mm_add_ps(vx, _mm_mul_ps(ax, vdt));
+        __m128 accVy = _mm_add_ps(vy, _mm_mul_ps(ay, vdt));
+        __m128 accVz = _mm_add_ps(vz, _mm_mul_ps(az, vdt));
+
+        // inside: semi-implicit Euler; outside and inward: explicit; outside otherwise: stop
+        __m128 nx = select4(outside, select4(inward, projX, px), _mm_add_ps(px, _mm_mul_ps(accVx, vdt)));
+        __m128 ny = select4(outside, select4(inward, projY, py), _mm_add_ps(py, _mm_mul_ps(accVy, vdt)));
+        __m128 nz = select4(outside, select4(inward, projZ, pz), _mm_add_ps(pz, _mm_mul_ps(accVz, vdt)));
+        __m128 nvx = select4(outside, _mm_and_ps(inward, accVx), accVx);
+        __m128 nvy = select4(outside, _mm_and_ps(inward, accVy), accVy);
+        __m128 nvz = select4(outside, _mm_and_ps(inward, accVz), accVz);
+
+        nvx = _mm_mul_ps(nvx, vdamping);
+        nvy = _mm_mul_ps(nvy, vdamping);
+        nvz = _mm_mul_ps(nvz, vdamping);
+
+        __m128 nAngVel = _mm_add_ps(angVel, _mm_mul_ps(_mm_loadu_ps(&b.angularAccel[i]), vdt));
+        __m128 nAngle = _mm_add_ps(angle, _mm_mul_ps(nAngVel, vdt));
+        nAngVel = _mm_mul_ps(nAngVel, vdamping);
+
+        // free bodies just drift
+        _mm_storeu_ps(&b.x[i], select4(confined, nx, projX));
+        _mm_storeu_ps(&b.y[i], select4(confined, ny, projY));
+        _mm_storeu_ps(&b.z[i], select4(confined, nz, projZ));
+        _mm_storeu_ps(&b.vx[i], select4(confined, nvx, vx));
+        _mm_storeu_ps(&b.vy[i], select4(confined, nvy, vy));
+        _mm_storeu_ps(&b.vz[i], select4(confined, nvz, vz));
+        _mm_storeu_ps(&b.angle[i], select4(confined, nAngle, angle));
+        _mm_storeu_ps(&b.angularVelocity[i], select4(confined, nAngVel, angVel));
+    }
+#endif
+    for(; i < count; i++)
+        integrateBody(b, i, fdt, damping);
+}
+
+// Integrates every simulated body.
+inline void motionSystem(EntityWorld& world, double dt)
+{
+    motionSystem(world, dt, 0, world.bodies.size());
+}
+
+// Bounces confined bodies [begin, end) that sank below the ground back onto
+// it. Ground is anything with a heightAt(x, z).
+template<typename Ground>
+inline void groundSystem(EntityWorld& world, const Ground& ground, size_t begin, size_t end)
+{
+    Bodies& b = world.bodies;
+    for(size_t i = begin; i < end; i++) {
+        if(b.confined[i] == 0)
+            continue;
+        float h = ground.heightAt(b.x[i], b.z[i]);
+        if(b.y[i] < h) {
+            b.y[i] = h;
+            if(b.vy[i] < 0)
+                b.vy[i] *= -b.restitution[i];
+        }
+    }
+}
+
+template<typename Ground>
+inline void groundSystem(EntityWorld& world, const Ground& ground)
+{
+    groundSystem(world, ground, 0, world.bodies.size());
+}
+
+// Appends every collectible within reach of the collector to hits. Only the
+// grid cells around the collector are visited; collectibles must be in grid.
+template<typename Container>
+inline void collectibleSystem(EntityWorld& world, const SpatialHash& grid, Entity collector, Container& hits)
+{
+    grid.query(world.positionOf(collector), hits);
+}
+
+// how many times a swept body may hit something and slide on in one step
+const int MAX_SWEEPS = 4;
+
+// Continuous collision for fast bodies. A confined body whose sphere moved
+// further than its radius this step could have skipped past a trunk or an
+// island wall, so its motion is swept from the previous position instead:
+// it stops at the first static obstacle or wall in the way, loses the velocity
+// into it and slides on with what is left of the step. Slow bodies are left
+// to collisionSystem. Call between motionSystem and collisionSystem.
+template<typename Container>
+inline void continuousCollisionSystem(EntityWorld& world, Container& candidates)
+{
+    Bodies& b = world.bodies;
+    for(size_t i = 0; i < world.colliders.size(); i++) {
+        Entity e = world.colliders.ownerAt(i);
+        const Collider& c = world.colliders[i];
+        if(c.radius <= 0 || !b.has(e))
+            continue;
+        unsigned int s = b.slot(e);
+        if(b.confined[s] == 0)
+            continue;
+        float3 pos = b.previousPosition(s) + c.offset;
+        float3 remaining = b.position(s) + c.offset - pos;
+        if(remaining.norm2() <= c.radius * c.radius)
+            continue;
+
+        float3 vel(b.vx[s], b.vy[s], b.vz[s]);
+        for(int sweep = 0; sweep < MAX_SWEEPS && remaining.norm2() > 0; sweep++) {
+            AABB swept = AABB::around(pos, float3(c.radius, c.radius, c.radius));
+            swept.extend(AABB::around(pos + remaining, float3(c.radius, c.radius, c.radius)));
+            candidates.clear();
+            world.broadphase.query(swept, candidates);
+
+            float tHit = 1;
+            float3 hitNormal(0, 0, 0);
+            for(size_t k = 0; k < candidates.size(); k++) {
+                Entity other = candidates[k];
+                if(other == e || b.has(other))
+                    continue;
+                // the sphere against the obstacle grown by its radius
+                AABB grown = world.boundsOf(other, world.colliders.get(other)).expanded(c.radius);
+                float t;
+                float3 normal;
+                if(grown.intersectSegment(pos, remaining, t, normal) && t < tHit) {
+                    tHit = t;
+                    hitNormal = normal;
+                }
+            }
+            // island walls, for the body position rather than the sphere center
+            float walls[4] = {ISLAND_EXTENT + c.offset.x, -ISLAND_EXTENT + c.offset.x,
+                              ISLAND_EXTENT + c.offset.z, -ISLAND_EXTENT + c.offset.z};
+            for(int w = 0; w < 4; w++) {
+                float from = w < 2 ? pos.x : pos.z;
+                float by = w < 2 ? remaining.x : remaining.z;
+                bool crosses = (w % 2 == 0) ? (from <= walls[w] && from + by > walls[w])
+                                            : (from >= walls[w] && from + by < walls[w]);
+                if(!crosses)
+                    continue;
+                float t = (walls[w] - from) / by;
+                if(t < tHit) {
+                    tHit = t;
+                    float side = (w % 2 == 0) ? -1.0f : 1.0f;
+                    hitNormal = w < 2 ? float3(side, 0, 0) : float3(0, 0, side);
+                }
+            }
+
+            if(tHit >= 1) {
+                pos += remaining;
+                break;
+            }
+            pos += remaining * tHit;
+            remaining = remaining * (1 - tHit);
+            remaining -= hitNormal * remaining.dot(hitNormal);
+            float vn = vel.dot(hitNormal);
+            if(vn < 0)
+                vel -= hitNormal * vn;
+        }
+
+        float3 p = pos - c.offset;
+        b.x[s] = p.x; b.y[s] = p.y; b.z[s] = p.z;
+        b.setVelocity(s, vel);
+    }
+}
+
+// Pushes two overlapping shapes apart. normal points from a to b; only
+// confined bodies are moved, everything else is treated as immovable.
+inline void resolveContact(EntityWorld& world, Entity a, Entity b, const float3& normal, float depth)
+{
+    Bodies& bodies = world.bodies;
+    bool movesA = bodies.has(a) && bodies.confined[bodies.slot(a)] != 0;
+    bool movesB = bodies.has(b) && bodies.confined[bodies.slot(b)] != 0;
+    if(!movesA && !movesB)
+        return;
+    float shareA = movesA ? (movesB ? 0.5f : 1.0f) : 0.0f;
+    float shareB = 1.0f - shareA;
+    Entity entities[2] = {a, b};
+    float3 pushes[2] = {normal * (-depth * shareA), normal * (depth * shareB)};
+    for(int k = 0; k < 2; k++) {
+        if(!(k == 0 ? movesA : movesB))
+            continue;
+        unsigned int i = bodies.slot(entities[k]);
+        bodies.x[i] += pushes[k].x;
+        bodies.y[i] += pushes[k].y;
+        bodies.z[i] += pushes[k].z;
+        // drop the part of the velocity that heads into the other shape
+        float3 n = k == 0 ? -normal : normal;
+        float3 v(bodies.vx[i], bodies.vy[i], bodies.vz[i]);
+        float vn = v.dot(n);
+        if(vn < 0)
+            bodies.setVelocity(i, v - n * vn);
+    }
+}
+
+// Exact test for a broadphase pair. Returns false if the shapes do not touch,
+// otherwise the normal from a to b and the penetration depth.
+inline bool collideShapes(EntityWorld& world, Entity a, const Collider& ca, Entity b, const Collider& cb,
+                          float3& normal, float& depth)
+{
+    // keep a sphere first if there is one
+    if(ca.radius <= 0 && cb.radius > 0) {
+        bool hit = collideShapes(world, b, cb, a, ca, normal, depth);
+        normal = -normal;
+        return hit;
+    }
+    float3 centerA = world.positionOf(a) + ca.offset;
+    float3 centerB = world.positionOf(b) + cb.offset;
+    if(ca.radius > 0 && cb.radius > 0) {
+        float3 d = centerB - centerA;
+        float r = ca.radius + cb.radius;
+        float dist2 = d.norm2();
+        if(dist2 >= r * r)
+            return false;
+        float dist = sqrtf(dist2);
+        normal = dist > 0 ? d * (1.0f / dist) : float3(0, 1, 0);
+        depth = r - dist;
+        return true;
+    }
+    if(ca.radius > 0) {
+        AABB box = AABB::around(centerB, cb.halfExtents);
+        float3 closest = box.clamp(centerA);
+        float3 d = closest - centerA;
+        float dist2 = d.norm2();
+        if(dist2 >= ca.radius * ca.radius)
+            return false;
+        if(dist2 > 0) {
+            float dist = sqrtf(dist2);
+            normal = d * (1.0f / dist);
+            depth = ca.radius - dist;
+            return true;
+        }
+        // sphere center inside the box: fall through to the box test
+    }
+    // boxes: separate along the axis of least penetration
+    float3 ha = ca.radius > 0 ? float3(ca.radius, ca.radius, ca.radius) : ca.halfExtents;
+    float3 d = centerB - centerA;
+    float3 overlap = ha + cb.halfExtents - float3(fabsf(d.x), fabsf(d.y), fabsf(d.z));
+    if(overlap.x <= 0 || overlap.y <= 0 || overlap.z <= 0)
+        return false;
+    if(overlap.x < overlap.y && overlap.x < overlap.z) {
+        normal = float3(d.x < 0 ? -1.0f : 1.0f, 0, 0);
+        depth = overlap.x;
+    } else if(overlap.y < overlap.z) {
+        normal = float3(0, d.y < 0 ? -1.0f : 1.0f, 0);
+        depth = overlap.y;
+    } else {
+        normal = float3(0, 0, d.z < 0 ? -1.0f : 1.0f);
+        depth = overlap.z;
+    }
+    return true;
+}
+
+// Updates the broadphase boxes of moving colliders, collects overlapping
+// pairs into the caller's scratch container and resolves the contacts.
+template<typename Container>
+inline CollisionStats collisionSystem(EntityWorld& world, Container& pairs)
+{
+    for(size_t i = 0; i < world.colliders.size(); i++) {
+        Entity e = world.colliders.ownerAt(i);
+        if(world.bodies.has(e))
+            world.broadphase.update(world.colliders[i].proxy, world.boundsOf(e, world.colliders[i]));
+    }
+    pairs.clear();
+    world.broadphase.findPairs(pairs);
+
+    CollisionStats stats = {world.broadphase.size(), pairs.size(), 0};
+    for(size_t i = 0; i < pairs.size(); i++) {
+        Entity a = pairs[i].first;
+        Entity b = pairs[i].second;
+        float3 normal(0, 0, 0);
+        float depth = 0;
+        if(collideShapes(world, a, world.colliders.get(a), b, world.colliders.get(b), normal, depth)) {
+            resolveContact(world, a, b, normal, depth);
+            stats.contacts++;
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+// GLSL 1.20 sources of the forward renderer: per-pixel Blinn-Phong over
+// arrays of lights given in world space. OpenGL 2.1 has no uniform buffers,
+// so the lights are plain uniform arrays, set once whenever they change.
+// Materials still go through glMaterial and are read from gl_FrontMaterial.
+// The sun's shadow comes from SHADOW_FUNCTIONS: each fragment picks the
+// cascade its view depth falls into, so the scene is drawn once, with the
+// camera's whole projection.
+// Point lights beyond those few come from LightClusters: a fragment finds its
+// froxel from its window position and view depth and reads only that
+// froxel's lights out of the cluster textures. The grid constants below must
+// match LightClusters.
+// The fragment shader is SHADING_FUNCTIONS, SHADOW_FUNCTIONS and
+// FORWARD_FRAGMENT_SHADER.
+
+const int MAX_SHADER_LIGHTS = 32;
+
+const char* const FORWARD_VERTEX_SHADER =
+	"#version 120\n"
+	"uniform mat4 uViewInverse;\n"
+	"varying vec3 vWorldPos;\n"
+	"varying vec3 vWorldNormal;\n"
+	"varying float vViewDepth;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 eyePos = gl_ModelViewMatrix * gl_Vertex;\n"
+	"	vViewDepth = -eyePos.z;\n"
+	"	vWorldPos = (uViewInverse * eyePos).xyz;\n"
+	"	vWorldNormal = mat3(uViewInverse) * (gl_NormalMatrix * gl_Normal);\n"
+	"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+	"	// the same depths as the fixed-function depth pre-pass\n"
+	"	gl_Position = ftransform();\n"
+	"}\n";
+
+// Lighting shared by the forward and the deferred fragment shaders; their
+// own main() is appended to it.
+const char* const SHADING_FUNCTIONS =
+	"#version 120\n"
+	"const int MAX_LIGHTS = 32;\n"
+	"const vec3 CLUSTER_GRID = vec3(16.0, 16.0, 24.0);\n"
+	"const int MAX_LIGHTS_PER_CLUSTER = 64;\n"
+	"const vec2 INDEX_TEXTURE_SIZE = vec2(4096.0, 16.0);\n"
+	"const float MAX_CLUSTERED_LIGHTS = 1024.0;\n"
+	"uniform mat4 uViewInverse;\n"
+	"uniform int uLightCount;\n"
+	"uniform vec4 uLightPosition[MAX_LIGHTS];	// w = 0 for directional lights\n"
+	"uniform vec3 uLightPower[MAX_LIGHTS];\n"
+	"uniform float uLightAttenuation[MAX_LIGHTS];	// quadratic, 0 for none\n"
+	"uniform int uShadowedLight;\n"
+	"uniform bool uClustered;\n"
+	"uniform sampler2D uClusters;	// first index, light count\n"
+	"uniform sampler2D uLightIndices;\n"
+	"uniform sampler2D uClusterLights;	// position and radius, then power\n"
+	"uniform vec2 uTileSize;	// in pixels\n"
+	"uniform float uClusterNear;\n"
+	"uniform float uSliceScale;	// slices per unit of log depth\n"
+	"// the ambient light reflected by a surface of diffuse color kd; the\n"
+	"// ambient reflectance is a fifth of the diffuse one, as Material sets it\n"
+	"vec3 ambient(vec3 kd)\n"
+	"{\n"
+	"	return 0.2 * gl_LightModel.ambient.rgb * kd;\n"
+	"}\n"
+	"vec3 shade(vec3 n, vec3 v, vec3 l, vec3 power, vec3 kd, vec3 ks, float shininess)\n"
+	"{\n"
+	"	float nl = dot(n, l);\n"
+	"	if(nl <= 0.0)\n"
+	"		return vec3(0.0);\n"
+	"	vec3 h = normalize(l + v);\n"
+	"	float specular = pow(max(dot(n, h), 0.0), shininess);\n"
+	"	return power * (kd * nl + ks * specular);\n"
+	"}\n"
+	"// the uniform lights; shadow dims the shadowed one\n"
+	"vec3 shadeLights(vec3 position, vec3 n, vec3 v, vec3 kd, vec3 ks, float shininess, float shadow)\n"
+	"{\n"
+	"	vec3 color = vec3(0.0);\n"
+	"	for(int i = 0; i < MAX_LIGHTS; i++)\n"
+	"	{\n"
+	"		if(i >= uLightCount)\n"
+	"			break;\n"
+	"		vec3 l = uLightPosition[i].xyz;\n"
+	"		float attenuation = 1.0;\n"
+	"		if(uLightPosition[i].w != 0.0)\n"
+	"		{\n"
+	"			l -= position;\n"
+	"			float d2 = dot(l, l);\n"
+	"			if(uLightAttenuation[i] > 0.0)\n"
+	"				attenuation = 1.0 / (uLightAttenuation[i] * d2);\n"
+	"		}\n"
+	"		if(i == uShadowedLight)\n"
+	"			attenuation *= shadow;\n"
+	"		color += shade(n, v, normalize(l), uLightPower[i] * attenuation, kd, ks, shininess);\n"
+	"	}\n"
+	"	return color;\n"
+	"}\n"
+	"// the lights of the froxel at this pixel and view depth\n"
+	"vec3 shadeClusters(vec3 position, float viewDepth, vec3 n, vec3 v, vec3 kd, vec3 ks, float shininess)\n"
+	"{\n"
+	"	vec2 tile = min(floor(gl_FragCoord.xy / uTileSize), CLUSTER_GRID.xy - 1.0);\n"
+	"	float slice = clamp(floor(log(max(viewDepth, uClusterNear) / uClusterNear) * uSliceScale), 0.0, CLUSTER_GRID.z - 1.0);\n"
+	"	vec2 cluster = texture2D(uClusters, vec2(\n"
+	"		(tile.y * CLUSTER_GRID.x + tile.x + 0.5) / (CLUSTER_GRID.x * CLUSTER_GRID.y),\n"
+	"		(slice + 0.5) / CLUSTER_GRID.z)).ra;\n"
+	"	vec3 color = vec3(0.0);\n"
+	"	for(int i = 0; i < MAX_LIGHTS_PER_CLUSTER; i++)\n"
+	"	{\n"
+	"		if(float(i) >= cluster.y)\n"
+	"			break;\n"
+	"		float index = cluster.x + float(i);\n"
+	"		float light = texture2D(uLightIndices, vec2(\n"
+	"			(mod(index, INDEX_TEXTURE_SIZE.x) + 0.5) / INDEX_TEXTURE_SIZE.x,\n"
+	"			(floor(index / INDEX_TEXTURE_SIZE.x) + 0.5) / INDEX_TEXTURE_SIZE.y)).r;\n"
+	"		float u = (light + 0.5) / MAX_CLUSTERED_LIGHTS;\n"
+	"		vec4 center = texture2D(uClusterLights, vec2(u, 0.25));\n"
+	"		vec3 l = center.xyz - position;\n"
+	"		float d2 = dot(l, l);\n"
+	"		// fades to nothing at the radius, so culling by it is invisible\n"
+	"		float fade = clamp(1.0 - d2 * d2 / (center.w * center.w * center.w * center.w), 0.0, 1.0);\n"
+	"		if(fade == 0.0)\n"
+	"			continue;\n"
+	"		vec3 power = texture2D(uClusterLights, vec2(u, 0.75)).rgb;\n"
+	"		color += shade(n, v, normalize(l), power * (fade * fade / (d2 + 1.0)), kd, ks, shininess);\n"
+	"	}\n"
+	"	return color;\n"
+	"}\n";
+
+// The sun's cascaded shadow maps, as ShadowCascades::bind leaves them.
+// CASCADES must match ShadowCascades::MAX_CASCADES; GLSL 1.20 indexes sampler
+// arrays by constants only, hence the unrolled choice.
+const char* const SHADOW_FUNCTIONS =
+	"const int CASCADES = 4;\n"
+	"uniform sampler2DShadow uShadowMaps[CASCADES];\n"
+	"uniform mat4 uShadowMatrices[CASCADES];	// world to each map's texture space\n"
+	"uniform float uCascadeEnds[CASCADES];	// view depth where each cascade ends\n"
+	"uniform int uCascadeCount;\n"
+	"// 1 where the sun reaches position, 0 in its shadow\n"
+	"float sunShadow(vec3 position, float viewDepth)\n"
+	"{\n"
+	"	vec4 p = vec4(position, 1.0);\n"
+	"	if(uCascadeCount < 2 || viewDepth < uCascadeEnds[0])\n"
+	"		return shadow2DProj(uShadowMaps[0], uShadowMatrices[0] * p).r;\n"
+	"	if(uCascadeCount < 3 || viewDepth < uCascadeEnds[1])\n"
+	"		return shadow2DProj(uShadowMaps[1], uShadowMatrices[1] * p).r;\n"
+	"	if(uCascadeCount < 4 || viewDepth < uCascadeEnds[2])\n"
+	"		return shadow2DProj(uShadowMaps[2], uShadowMatrices[2] * p).r;\n"
+	"	return shadow2DProj(uShadowMaps[3], uShadowMatrices[3] * p).r;\n"
+	"}\n";
+
+const char* const FORWARD_FRAGMENT_SHADER =
+	"uniform sampler2D uTexture;\n"
+	"uniform bool uTextured;\n"
+	"uniform bool uLit;\n"
+	"varying vec3 vWorldPos;\n"
+	"varying vec3 vWorldNormal;\n"
+	"varying float vViewDepth;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 texel = uTextured ? texture2D(uTexture, gl_TexCoord[0].st) : vec4(1.0);\n"
+	"	if(!uLit)\n"
+	"	{\n"
+	"		gl_FragColor = texel;\n"
+	"		return;\n"
+	"	}\n"
+	"	vec3 n = normalize(vWorldNormal);\n"
+	"	vec3 v = normalize(uViewInverse[3].xyz - vWorldPos);\n"
+	"	vec3 kd = gl_FrontMaterial.diffuse.rgb;\n"
+	"	vec3 ks = gl_FrontMaterial.specular.rgb;\n"
+	"	float shininess = gl_FrontMaterial.shininess;\n"
+	"	vec3 color = ambient(kd);\n"
+	"	color += shadeLights(vWorldPos, n, v, kd, ks, shininess, sunShadow(vWorldPos, vViewDepth));\n"
+	"	if(uClustered)\n"
+	"		color += shadeClusters(vWorldPos, vViewDepth, n, v, kd, ks, shininess);\n"
+	"	gl_FragColor = vec4(color, gl_FrontMaterial.diffuse.a) * texel;\n"
+	"}\n";
@@ -0,0 +1,49 @@
+#include "FrameArena.h"
+#include <stdlib.h>
+#include <new>
+
+FrameArena::FrameArena(size_t blockSize):block(0), used(0), blockSize(blockSize)
+{
+}
+
+FrameArena::~FrameArena()
+{
+	for(size_t i = 0; i < blocks.size(); i++)
+		free(blocks[i].memory);
+}
+
+// The current block is full: on to the next one big enough, or a new one.
+// Blocks skipped on the way stay unused until the next reset.
+void* FrameArena::allocateInNextBlock(size_t size)
+{
+	if(block < blocks.size())
+		block++;
+	while(block < blocks.size() && blocks[block].size < size)
+		block++;
+	if(block == blocks.size())
+	{
+		Block fresh;
+		fresh.size = size > blockSize ? size : blockSize;
+		fresh.memory = (char*)malloc(fresh.size);
+		if(!fresh.memory)
+			throw std::bad_alloc();
+		blocks.push_back(fresh);
+	}
+	// blocks start at malloc's alignment, which is as much as allocate() takes
+	used = size;
+	return blocks[block].memory;
+}
+
+void FrameArena::reset()
+{
+	block = 0;
+	used = 0;
+}
+
+size_t FrameArena::getCapacity() const
+{
+	size_t capacity = 0;
+	for(size_t i = 0; i < blocks.size(); i++)
+		capacity += blocks[i].size;
+	return capacity;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+// Memory for data that lives no longer than a frame. Allocating bumps a
+// pointer, nothing is freed on its own, and reset() makes all of it reusable
+// at once. Blocks are kept across resets, so once an arena has grown to what
+// a frame needs, frames stop going to the heap.
+// Destructors are not run: whoever puts an object with one here calls it.
+// An arena is used by one thread at a time.
+class FrameArena
+{
+	struct Block
+	{
+		char* memory;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t block;		// the one being filled
+	size_t used;		// bytes of it
+	size_t blockSize;
+
+	void* allocateInNextBlock(size_t size);
+public:
+	explicit FrameArena(size_t blockSize = 64 * 1024);
+	~FrameArena();
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// alignment is a power of two, at most that of malloc
+	void* allocate(size_t size, size_t alignment)
+	{
+		if(block < blocks.size())
+		{
+			size_t start = (used + alignment - 1) & ~(alignment - 1);
+			if(start + size <= blocks[block].size)
+			{
+				used = start + size;
+				return blocks[block].memory + start;
+			}
+		}
+		return allocateInNextBlock(size);
+	}
+
+	// Forgets everything allocated, keeping the memory for the next frame.
+	void reset();
+	// bytes held, used or not
+	size_t getCapacity() const;
+};
+
+// Lets standard containers take their memory from an arena. Deallocating
+// does nothing: the memory comes back when the arena is reset, so such a
+// container must be gone by then.
+template<typename T> class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	FrameArena* arena;
+
+	// not explicit, so that containers can be given the arena itself
+	ArenaAllocator(FrameArena& arena):arena(&arena){}
+	template<typename U> ArenaAllocator(const ArenaAllocator<U>& other):arena(other.arena){}
+
+	T* allocate(size_t count)
+	{
+		return (T*)arena->allocate(count * sizeof(T), alignof(T));
+	}
+	void deallocate(T*, size_t)
+	{
+	}
+};
+
+template<typename T, typename U> bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena == b.arena;
+}
+
+template<typename T, typename U> bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena != b.arena;
+}
+
+// a vector for one frame's use, as in FrameVector<Entity> hits(arena)
+template<typename T> using FrameVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "float4x4.h"
+#include "AABB.h"
+
+// View frustum as six planes a*x + b*y + c*z + d >= 0, inside facing.
+// Built from a model-view-projection matrix, it lives in that model's space.
+class Frustum
+{
+public:
+	float planes[6][4];	// left, right, bottom, top, near, far
+
+	static Frustum fromMatrix(const float4x4& m)
+	{
+		// rows of the column-major matrix
+		float r[4][4];
+		for(int row = 0; row < 4; row++)
+			for(int col = 0; col < 4; col++)
+				r[row][col] = m.m[col * 4 + row];
+		Frustum f;
+		for(int k = 0; k < 4; k++)
+		{
+			f.planes[0][k] = r[3][k] + r[0][k];
+			f.planes[1][k] = r[3][k] - r[0][k];
+			f.planes[2][k] = r[3][k] + r[1][k];
+			f.planes[3][k] = r[3][k] - r[1][k];
+			f.planes[4][k] = r[3][k] + r[2][k];
+			f.planes[5][k] = r[3][k] - r[2][k];
+		}
+		return f;
+	}
+
+	// false only if the box is certainly outside
+	bool intersects(const AABB& box) const
+	{
+		for(int i = 0; i < 6; i++)
+		{
+			const float* p = planes[i];
+			// the corner furthest along the plane normal
+			float x = p[0] >= 0 ? box.max.x : box.min.x;
+			float y = p[1] >= 0 ? box.max.y : box.min.y;
+			float z = p[2] >= 0 ? box.max.z : box.min.z;
+			if(p[0] * x + p[1] * y + p[2] * z + p[3] < 0)
+				return false;
+		}
+		return true;
+	}
+};
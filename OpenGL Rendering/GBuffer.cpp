@@ -0,0 +1,111 @@
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+
+#include "GBuffer.h"
+
+GBuffer::GBuffer():width(0), height(0), framebuffer(0), complete(false)
+{
+	for(int i = 0; i < TEXTURE_COUNT; i++)
+		textures[i] = 0;
+}
+
+GBuffer::~GBuffer()
+{
+	destroy();
+}
+
+void GBuffer::create()
+{
+	const GLint formats[TEXTURE_COUNT] = {
+		GL_RGBA8, GL_RGBA16F_ARB, GL_RGBA8, GL_DEPTH_COMPONENT24 };
+	glGenTextures(TEXTURE_COUNT, textures);
+	for(int i = 0; i < TEXTURE_COUNT; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		if(i == DEPTH)
+			glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, GL_RGBA, GL_FLOAT, 0);
+		// read back pixel for pixel
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffersEXT(1, &framebuffer);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+	for(int i = 0; i < COLOR_TARGETS; i++)
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT + i, GL_TEXTURE_2D, textures[i], 0);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, textures[DEPTH], 0);
+	GLenum buffers[COLOR_TARGETS];
+	for(int i = 0; i < COLOR_TARGETS; i++)
+		buffers[i] = GL_COLOR_ATTACHMENT0_EXT + i;
+	glDrawBuffers(COLOR_TARGETS, buffers);
+	complete = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) == GL_FRAMEBUFFER_COMPLETE_EXT;
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
+
+void GBuffer::destroy()
+{
+	if(framebuffer)
+		glDeleteFramebuffersEXT(1, &framebuffer);
+	if(textures[0])
+		glDeleteTextures(TEXTURE_COUNT, textures);
+	framebuffer = 0;
+	complete = false;
+	for(int i = 0; i < TEXTURE_COUNT; i++)
+		textures[i] = 0;
+}
+
+bool GBuffer::fitViewport()
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if(!framebuffer || viewport[2] != width || viewport[3] != height)
+	{
+		destroy();
+		width = viewport[2];
+		height = viewport[3];
+		create();
+	}
+	return complete;
+}
+
+void GBuffer::begin()
+{
+	fitViewport();
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+	glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT);
+	glViewport(0, 0, width, height);
+	// zero normals: nothing is lit where nothing is drawn
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void GBuffer::end()
+{
+	glPopAttrib();
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
+
+void GBuffer::bind(unsigned int firstUnit)
+{
+	for(int i = 0; i < TEXTURE_COUNT; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void GBuffer::unbind(unsigned int firstUnit)
+{
+	for(int i = 0; i < TEXTURE_COUNT; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// Render targets of deferred shading. The geometry pass writes, for every
+// pixel of the nearest surface:
+// - ALBEDO: diffuse color, texture included,
+// - NORMAL: world space normal and shininess; a zero normal marks unlit
+//   surfaces, whose albedo is their final color,
+// - SPECULAR: specular color, texture included, and how much of the sun
+//   reaches the surface,
+// - DEPTH: window depth, 1 where nothing was drawn.
+// A lighting pass over the whole screen then reads them back as textures and
+// rebuilds each pixel's position from its depth.
+class GBuffer
+{
+public:
+	enum
+	{
+		ALBEDO,
+		NORMAL,
+		SPECULAR,
+		DEPTH,
+		TEXTURE_COUNT,
+		COLOR_TARGETS = DEPTH
+	};
+private:
+	int width;
+	int height;
+	unsigned int textures[TEXTURE_COUNT];
+	unsigned int framebuffer;
+	bool complete;		// whether the driver can render into it
+
+	void create();
+	void destroy();
+public:
+	GBuffer();
+	~GBuffer();
+
+	// Sizes the buffers to the current viewport, unless they already are.
+	// False if the framebuffer is incomplete at that size, as with formats
+	// the driver cannot render into; begin() must not be called then.
+	bool fitViewport();
+
+	// Renders into the buffers between begin() and end(). The buffers follow
+	// the size of the current viewport.
+	void begin();
+	void end();
+
+	// binds the textures, in the order above, to units from firstUnit on
+	void bind(unsigned int firstUnit);
+	void unbind(unsigned int firstUnit);
+
+	int getWidth() const
+	{
+		return width;
+	}
+	int getHeight() const
+	{
+		return height;
+	}
+};
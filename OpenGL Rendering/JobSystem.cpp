@@ -0,0 +1,193 @@
+#include "JobSystem.h"
+#include <stdio.h>
+#include <algorithm>
+
+namespace
+{
+	// which pool, and which of its threads, this thread works for
+	__thread const JobSystem* workerOf = 0;
+	__thread int workerIndex = 0;
+}
+
+JobSystem::JobSystem(int threads):queued(0), stopping(false), tracing(false)
+{
+	start(threads);
+}
+
+JobSystem::~JobSystem()
+{
+	stop();
+}
+
+void JobSystem::start(int threads)
+{
+	if(threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	stopping = false;
+	for(int i = 0; i < threads; i++)
+		queues.push_back(new Queue());
+	for(int i = 1; i < threads; i++)
+		workers.push_back(std::thread(&JobSystem::work, this, i));
+}
+
+void JobSystem::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+	for(size_t i = 0; i < queues.size(); i++)
+		delete queues[i];
+	queues.clear();
+}
+
+void JobSystem::setThreadCount(int threads)
+{
+	stop();
+	start(threads);
+}
+
+int JobSystem::currentThread() const
+{
+	// threads outside the pool share thread 0's queue
+	return workerOf == this ? workerIndex : 0;
+}
+
+void JobSystem::run(const Job& job, Counter& counter, const char* name)
+{
+	counter.pending++;
+	Entry entry = {job, &counter, name};
+	Queue& queue = *queues[currentThread()];
+	{
+		std::lock_guard<std::mutex> lock(queue.lock);
+		queue.jobs.push_back(entry);
+	}
+	queued++;
+	// taking the lock orders us after a worker's last look at queued
+	{
+		std::lock_guard<std::mutex> lock(sleepLock);
+	}
+	wake.notify_one();
+}
+
+bool JobSystem::runOne(int thread, const Counter* only)
+{
+	Entry entry;
+	bool found = false;
+	int count = (int)queues.size();
+	for(int k = 0; k < count && !found; k++)
+	{
+		Queue& queue = *queues[(thread + k) % count];
+		std::lock_guard<std::mutex> lock(queue.lock);
+		int size = (int)queue.jobs.size();
+		// our own newest job is the one most likely still in cache;
+		// a thief takes the oldest, which tends to be the biggest
+		for(int j = 0; j < size; j++)
+		{
+			std::deque<Entry>::iterator i = queue.jobs.begin() + (k == 0 ? size - 1 - j : j);
+			if(only && i->counter != only)
+				continue;
+			entry = std::move(*i);
+			queue.jobs.erase(i);
+			found = true;
+			break;
+		}
+	}
+	if(!found)
+		return false;
+	queued--;
+	{
+		TraceScope scope(*this, entry.name);
+		entry.job();
+	}
+	entry.counter->pending--;
+	return true;
+}
+
+void JobSystem::wait(Counter& counter)
+{
+	int thread = currentThread();
+	while(counter.pending > 0)
+		if(!runOne(thread, &counter))
+			std::this_thread::yield();
+}
+
+void JobSystem::work(int thread)
+{
+	workerOf = this;
+	workerIndex = thread;
+	for(;;)
+	{
+		if(runOne(thread))
+			continue;
+		std::unique_lock<std::mutex> lock(sleepLock);
+		wake.wait(lock, [this]() { return stopping || queued > 0; });
+		if(stopping)
+			return;
+	}
+}
+
+void JobSystem::resetArenas()
+{
+	for(size_t i = 0; i < queues.size(); i++)
+		queues[i]->arena.reset();
+}
+
+long long JobSystem::traceTime() const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - traceStart).count();
+}
+
+void JobSystem::startTrace()
+{
+	tracing = false;
+	for(size_t i = 0; i < queues.size(); i++)
+	{
+		std::lock_guard<std::mutex> lock(queues[i]->lock);
+		queues[i]->trace.clear();
+	}
+	traceStart = std::chrono::steady_clock::now();
+	tracing = true;
+}
+
+bool JobSystem::writeTrace(const char* filename)
+{
+	tracing = false;
+	FILE* file = fopen(filename, "w");
+	if(!file)
+		return false;
+	fprintf(file, "{\"traceEvents\":[\n");
+	for(size_t i = 0; i < queues.size(); i++)
+	{
+		std::lock_guard<std::mutex> lock(queues[i]->lock);
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+			"\"args\":{\"name\":\"%s %d\"}}", (int)i, i ? "worker" : "main", (int)i);
+		const std::vector<TraceEvent>& trace = queues[i]->trace;
+		for(size_t e = 0; e < trace.size(); e++)
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+				trace[e].name, (int)i, trace[e].begin, trace[e].end - trace[e].begin);
+		fprintf(file, i + 1 < queues.size() ? ",\n" : "\n");
+	}
+	fprintf(file, "]}\n");
+	return fclose(file) == 0;
+}
+
+JobSystem::TraceScope::TraceScope(JobSystem& jobs, const char* name):
+	jobs(jobs), name(name), begin(jobs.tracing ? jobs.traceTime() : -1)
+{
+}
+
+JobSystem::TraceScope::~TraceScope()
+{
+	if(begin < 0 || !jobs.tracing)
+		return;
+	TraceEvent event = {name, begin, jobs.traceTime()};
+	Queue& queue = *jobs.queues[jobs.currentThread()];
+	std::lock_guard<std::mutex> lock(queue.lock);
+	queue.trace.push_back(event);
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FrameArena.h"
+
+// Pool of threads running small jobs. Every thread has its own queue: it
+// takes its newest job first, and when it runs dry it steals the oldest job
+// of another thread, so work spreads out without a central queue. The thread
+// that created the pool is thread 0. A thread that waits for a batch runs that
+// batch's jobs meanwhile, and only those: a long job queued to overlap the
+// waiter's own work, such as the simulation beside drawing, is left to the
+// other threads.
+// Jobs carry a name, which must outlive the pool (a string literal), so that
+// a trace of which thread ran what, and when, can be recorded.
+// Every thread also has a frame arena, for what its jobs need only until the
+// frame is over.
+class JobSystem
+{
+public:
+	typedef std::function<void()> Job;
+
+	// number of a batch's jobs that have not finished yet
+	struct Counter
+	{
+		std::atomic<int> pending;
+		Counter():pending(0){}
+	};
+
+	// Records the time until it goes out of scope as a bar on the calling
+	// thread's row of the trace, while one is being recorded.
+	class TraceScope
+	{
+		JobSystem& jobs;
+		const char* name;
+		long long begin;
+	public:
+		TraceScope(JobSystem& jobs, const char* name);
+		~TraceScope();
+	};
+private:
+	struct Entry
+	{
+		Job job;
+		Counter* counter;
+		const char* name;
+	};
+	struct TraceEvent
+	{
+		const char* name;
+		long long begin;	// microseconds since startTrace()
+		long long end;
+	};
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<Entry> jobs;
+		std::vector<TraceEvent> trace;	// what this thread ran
+		FrameArena arena;
+	};
+
+	std::vector<Queue*> queues;
+	std::vector<std::thread> workers;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<int> queued;
+	bool stopping;
+	std::atomic<bool> tracing;
+	std::chrono::steady_clock::time_point traceStart;
+
+	void start(int threads);
+	void stop();
+	void work(int thread);
+	// runs one queued job, of only's batch if given
+	bool runOne(int thread, const Counter* only = 0);
+	int currentThread() const;
+	long long traceTime() const;
+public:
+	// threads counts the calling thread; 0 means one per core
+	explicit JobSystem(int threads = 0);
+	~JobSystem();
+
+	// queues job on the calling thread's queue, counted by counter
+	void run(const Job& job, Counter& counter, const char* name = "job");
+	// runs counter's queued jobs until all of them are done
+	void wait(Counter& counter);
+
+	// Calls work(begin, end) over [0, count) in chunks of about grain items,
+	// spread over the threads, and returns when all are done.
+	template<typename Work> void parallelFor(int count, int grain, const Work& work,
+		const char* name = "parallelFor")
+	{
+		if(count <= grain || queues.size() == 1)
+		{
+			TraceScope scope(*this, name);
+			if(count > 0)
+				work(0, count);
+			return;
+		}
+		Counter counter;
+		for(int begin = grain; begin < count; begin += grain)
+		{
+			int end = begin + grain < count ? begin + grain : count;
+			run([&work, begin, end]() { work(begin, end); }, counter, name);
+		}
+		// the caller takes the first chunk
+		{
+			TraceScope scope(*this, name);
+			work(0, grain);
+		}
+		wait(counter);
+	}
+
+	int getThreadCount() const
+	{
+		return (int)queues.size();
+	}
+	// Resizes the pool; only while no jobs are queued. Drops the trace and
+	// the arenas.
+	void setThreadCount(int threads);
+
+	// The calling thread's arena; threads outside the pool share thread 0's.
+	FrameArena& getArena()
+	{
+		return queues[currentThread()]->arena;
+	}
+	// Call between frames, once nothing allocated from the arenas is in use.
+	void resetArenas();
+
+	// Starts recording every job run, dropping what was recorded before.
+	// Call between frames, while no jobs are running.
+	void startTrace();
+	// Stops recording and writes the jobs run since startTrace() as Chrome
+	// trace JSON, for chrome://tracing or Perfetto: one row per thread, one
+	// bar per job. False if the file cannot be written.
+	bool writeTrace(const char* filename);
+};
@@ -0,0 +1,207 @@
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+
+#include <math.h>
+#include <algorithm>
+
+#include "LightClusters.h"
+#include "JobSystem.h"
+
+namespace
+{
+	const int CLUSTER_COUNT = LightClusters::TILES_X * LightClusters::TILES_Y * LightClusters::SLICES;
+
+	unsigned int createFloatTexture(int internalFormat, int width, int height, int format)
+	{
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, 0);
+		// these are tables, not images
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+}
+
+LightClusters::LightClusters(JobSystem& jobs):
+	jobs(jobs), nearPlane(0.1f), farPlane(100), clusters(CLUSTER_COUNT),
+	clusterData(CLUSTER_COUNT * 2), indexData(INDEX_TEXTURE_WIDTH * INDEX_TEXTURE_HEIGHT),
+	lightData(MAX_LIGHTS * 2 * 4), lightCount(0), indexCount(0)
+{
+	clusterTexture = createFloatTexture(GL_LUMINANCE_ALPHA32F_ARB, TILES_X * TILES_Y, SLICES, GL_LUMINANCE_ALPHA);
+	indexTexture = createFloatTexture(GL_LUMINANCE32F_ARB, INDEX_TEXTURE_WIDTH, INDEX_TEXTURE_HEIGHT, GL_LUMINANCE);
+	lightTexture = createFloatTexture(GL_RGBA32F_ARB, MAX_LIGHTS, 2, GL_RGBA);
+}
+
+LightClusters::~LightClusters()
+{
+	glDeleteTextures(1, &clusterTexture);
+	glDeleteTextures(1, &indexTexture);
+	glDeleteTextures(1, &lightTexture);
+}
+
+int LightClusters::sliceOf(float depth) const
+{
+	if(depth <= nearPlane)
+		return 0;
+	int slice = (int)(logf(depth / nearPlane) / logf(farPlane / nearPlane) * SLICES);
+	return std::min(slice, (int)SLICES - 1);
+}
+
+void LightClusters::computeRanges(const std::vector<ClusteredLight>& lights, const float4x4& view,
+	float tanX, float tanY, size_t begin, size_t end)
+{
+	for(size_t i = begin; i < end; i++)
+	{
+		Range& range = ranges[i];
+		range.x0 = 1;
+		range.x1 = 0;
+
+		float3 p = view.transformPoint(lights[i].position);
+		float r = lights[i].radius;
+		float depth = -p.z;
+		if(depth + r < nearPlane || depth - r > farPlane)
+			continue;
+		float nearest = std::max(depth - r, nearPlane);
+		float farthest = depth + r;
+
+		// screen extents of the box around the sphere, widest at the depth
+		// that projects each side farthest out
+		float left = p.x - r, right = p.x + r;
+		float bottom = p.y - r, top = p.y + r;
+		left /= (left < 0 ? nearest : farthest) * tanX;
+		right /= (right > 0 ? nearest : farthest) * tanX;
+		bottom /= (bottom < 0 ? nearest : farthest) * tanY;
+		top /= (top > 0 ? nearest : farthest) * tanY;
+		if(left > 1 || right < -1 || bottom > 1 || top < -1)
+			continue;
+
+		range.x0 = std::max(0, (int)floorf((left + 1) * 0.5f * TILES_X));
+		range.x1 = std::min((int)TILES_X - 1, (int)floorf((right + 1) * 0.5f * TILES_X));
+		range.y0 = std::max(0, (int)floorf((bottom + 1) * 0.5f * TILES_Y));
+		range.y1 = std::min((int)TILES_Y - 1, (int)floorf((top + 1) * 0.5f * TILES_Y));
+		range.z0 = sliceOf(nearest);
+		range.z1 = sliceOf(farthest);
+	}
+}
+
+void LightClusters::assign(int sliceBegin, int sliceEnd)
+{
+	// each thread owns whole slices, so no two write the same cluster
+	for(int z = sliceBegin; z < sliceEnd; z++)
+		for(int c = z * TILES_X * TILES_Y; c < (z + 1) * TILES_X * TILES_Y; c++)
+			clusters[c].clear();
+	for(size_t i = 0; i < ranges.size(); i++)
+	{
+		const Range& range = ranges[i];
+		if(range.x0 > range.x1)
+			continue;
+		int z0 = std::max(range.z0, sliceBegin);
+		int z1 = std::min(range.z1, sliceEnd - 1);
+		for(int z = z0; z <= z1; z++)
+			for(int y = range.y0; y <= range.y1; y++)
+				for(int x = range.x0; x <= range.x1; x++)
+				{
+					std::vector<unsigned short>& cluster = clusters[(z * TILES_Y + y) * TILES_X + x];
+					if(cluster.size() < MAX_LIGHTS_PER_CLUSTER)
+						cluster.push_back((unsigned short)i);
+				}
+	}
+}
+
+void LightClusters::bin(const std::vector<ClusteredLight>& lights, const float4x4& view,
+	float fovy, float aspect, float nearPlane, float farPlane)
+{
+	this->nearPlane = nearPlane;
+	this->farPlane = farPlane;
+	lightCount = std::min(lights.size(), (size_t)MAX_LIGHTS);
+	ranges.resize(lightCount);
+
+	float tanY = tanf(fovy * 0.5f);
+	float tanX = tanY * aspect;
+	jobs.parallelFor(lightCount, 64, [&](int begin, int end)
+	{
+		computeRanges(lights, view, tanX, tanY, begin, end);
+	}, "light ranges");
+	jobs.parallelFor(SLICES, 2, [this](int begin, int end)
+	{
+		assign(begin, end);
+	}, "cluster slices");
+
+	// pack the clusters back to back, dropping what the index texture cannot hold
+	const unsigned int capacity = INDEX_TEXTURE_WIDTH * INDEX_TEXTURE_HEIGHT;
+	indexCount = 0;
+	for(int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		unsigned int count = std::min((unsigned int)clusters[c].size(), capacity - indexCount);
+		clusterData[c * 2] = (float)indexCount;
+		clusterData[c * 2 + 1] = (float)count;
+		for(unsigned int i = 0; i < count; i++)
+			indexData[indexCount + i] = clusters[c][i];
+		indexCount += count;
+	}
+	for(unsigned int i = 0; i < lightCount; i++)
+	{
+		float* position = &lightData[i * 4];
+		float* power = &lightData[(MAX_LIGHTS + i) * 4];
+		position[0] = lights[i].position.x;
+		position[1] = lights[i].position.y;
+		position[2] = lights[i].position.z;
+		position[3] = lights[i].radius;
+		power[0] = lights[i].power.x;
+		power[1] = lights[i].power.y;
+		power[2] = lights[i].power.z;
+		power[3] = 0;
+	}
+}
+
+void LightClusters::upload()
+{
+	glBindTexture(GL_TEXTURE_2D, clusterTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILES_X * TILES_Y, SLICES, GL_LUMINANCE_ALPHA, GL_FLOAT, &clusterData[0]);
+	int rows = (indexCount + INDEX_TEXTURE_WIDTH - 1) / INDEX_TEXTURE_WIDTH;
+	if(rows > 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, indexTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, INDEX_TEXTURE_WIDTH, rows, GL_LUMINANCE, GL_FLOAT, &indexData[0]);
+	}
+	if(lightCount > 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, lightTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lightCount, 1, GL_RGBA, GL_FLOAT, &lightData[0]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 1, lightCount, 1, GL_RGBA, GL_FLOAT, &lightData[MAX_LIGHTS * 4]);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void LightClusters::build(const std::vector<ClusteredLight>& lights, const float4x4& view,
+	float fovy, float aspect, float nearPlane, float farPlane)
+{
+	bin(lights, view, fovy, aspect, nearPlane, farPlane);
+	upload();
+}
+
+void LightClusters::bind(unsigned int firstUnit)
+{
+	unsigned int textures[] = {clusterTexture, indexTexture, lightTexture};
+	for(int i = 0; i < 3; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::unbind(unsigned int firstUnit)
+{
+	for(int i = 0; i < 3; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "float3.h"
+#include "float4x4.h"
+#include <vector>
+
+class JobSystem;
+
+// A point light with a limited reach, for clustered shading.
+struct ClusteredLight
+{
+	float3 position;
+	float radius;	// no light beyond this distance
+	float3 power;
+};
+
+// Clustered light culling. The view frustum is cut into a grid of froxels:
+// TILES_X x TILES_Y screen tiles, each split into SLICES depth slices spaced
+// exponentially between the near and far planes. Every frame the lights are
+// binned into the froxels their spheres touch, as jobs, and the
+// result goes to the shader as float textures (OpenGL 2.1 has no buffer
+// textures or storage buffers):
+// - the cluster texture holds (first index, light count) per froxel,
+// - the index texture holds the light indices of all froxels back to back,
+// - the light texture holds position and radius, then power, per light.
+// A fragment then only visits the lights of its own froxel.
+class LightClusters
+{
+public:
+	enum
+	{
+		TILES_X = 16,
+		TILES_Y = 16,
+		SLICES = 24,
+		MAX_LIGHTS = 1024,
+		MAX_LIGHTS_PER_CLUSTER = 64,
+		INDEX_TEXTURE_WIDTH = 4096,
+		INDEX_TEXTURE_HEIGHT = 16
+	};
+private:
+	struct Range
+	{
+		int x0, x1, y0, y1, z0, z1;	// inclusive; x0 > x1 when the light is out of view
+	};
+
+	JobSystem& jobs;
+	float nearPlane;
+	float farPlane;
+	std::vector<Range> ranges;
+	std::vector<std::vector<unsigned short> > clusters;
+
+	std::vector<float> clusterData;
+	std::vector<float> indexData;
+	std::vector<float> lightData;
+	unsigned int lightCount;
+	unsigned int indexCount;
+
+	unsigned int clusterTexture;
+	unsigned int indexTexture;
+	unsigned int lightTexture;
+
+	void computeRanges(const std::vector<ClusteredLight>& lights, const float4x4& view,
+		float tanX, float tanY, size_t begin, size_t end);
+	void assign(int sliceBegin, int sliceEnd);
+	int sliceOf(float depth) const;
+public:
+	explicit LightClusters(JobSystem& jobs);
+	~LightClusters();
+
+	// Bins lights into the froxels of a view with the given camera and
+	// perspective projection, and uploads the result.
+	void build(const std::vector<ClusteredLight>& lights, const float4x4& view,
+		float fovy, float aspect, float nearPlane, float farPlane);
+	// build() in two halves: bin() needs no GL context, upload() does
+	void bin(const std::vector<ClusteredLight>& lights, const float4x4& view,
+		float fovy, float aspect, float nearPlane, float farPlane);
+	void upload();
+
+	// binds the textures to units firstUnit, firstUnit + 1 and firstUnit + 2
+	void bind(unsigned int firstUnit);
+	void unbind(unsigned int firstUnit);
+
+	unsigned int getLightCount() const
+	{
+		return lightCount;
+	}
+	// light indices stored over all froxels
+	unsigned int getIndexCount() const
+	{
+		return indexCount;
+	}
+};
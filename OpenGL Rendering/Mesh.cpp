@@ -6,12 +6,15 @@
 #include <GLUT/glut.h>
 
 #include "mesh.h"
+#include "BVH.h"
+#include "Profiler.h"
 
 
 using namespace std;
 
-Mesh::Mesh(const char *filename)
+Mesh::Mesh(const char *filename, bool compileNow):modelid(0),bvh(0)
 {
+	PROFILE_ZONE("Mesh load");
 	fstream file(filename); 
 	if(!file.is_open())       
 	{
@@ -84,6 +87,15 @@ Mesh::Mesh(const char *filename)
 		}
 	}
 
+	if(compileNow)
+		compile();
+}
+
+void Mesh::compile()
+{
+	PROFILE_ZONE("Mesh compile");
+	if(submeshFaces.empty() || modelid != 0)
+		return;
 	modelid = glGenLists(submeshFaces.size());
 
 	for(int iSubmesh=0; iSubmesh<submeshFaces.size(); iSubmesh++)
@@ -148,8 +160,46 @@ void Mesh::drawSubmesh(unsigned int iSubmesh)
 	glCallList(modelid + iSubmesh);
 }
 
+void Mesh::getTriangles(std::vector<float3>& vertices) const
+{
+	for(unsigned int iSubmesh = 0; iSubmesh < submeshFaces.size(); iSubmesh++)
+	{
+		const std::vector<Face*>& faces = submeshFaces.at(iSubmesh);
+		for(unsigned int i = 0; i < faces.size(); i++)
+		{
+			const int* p = faces[i]->positionIndices;
+			vertices.push_back(*positions[p[0]-1]);
+			vertices.push_back(*positions[p[1]-1]);
+			vertices.push_back(*positions[p[2]-1]);
+			if(faces[i]->isQuad)
+			{
+				vertices.push_back(*positions[p[1]-1]);
+				vertices.push_back(*positions[p[2]-1]);
+				vertices.push_back(*positions[p[3]-1]);
+			}
+		}
+	}
+}
+
+const BVH& Mesh::getBVH()
+{
+	if(!bvh)
+	{
+		std::vector<float3> vertices;
+		getTriangles(vertices);
+		bvh = new BVH(vertices);
+	}
+	return *bvh;
+}
+
+AABB Mesh::getBounds()
+{
+	return getBVH().getBounds();
+}
+
 Mesh::~Mesh()
 {
+	delete bvh;
 	for(unsigned int i = 0; i < rows.size(); i++)
 		delete rows[i];   
 	for(unsigned int i = 0; i < positions.size(); i++)
@@ -1,7 +1,11 @@
 #pragma once
 #include "float2.h"
 #include "float3.h"
+#include "AABB.h"
 #include <vector>
+#include <string>
+
+class BVH;
 
 class   Mesh
 {
@@ -20,12 +24,23 @@ class   Mesh
 	std::vector<float2*>		texcoords;
 
 	int            modelid;
+	BVH*           bvh;		// built on first ray query
 
 public:
-	Mesh(const char *filename);
+	// Reads the file. The display lists are compiled at once unless
+	// compileNow is false; then the file may be read on any thread, and
+	// compile() called on the GL thread before drawing.
+	Mesh(const char *filename, bool compileNow = true);
 	~Mesh();
 
+	void        compile();
+
 	void        draw();
 	void        drawSubmesh(unsigned int iSubmesh);
+
+	// every face as three corners, quads split the same way draw() splits them
+	void        getTriangles(std::vector<float3>& vertices) const;
+	const BVH&  getBVH();
+	AABB        getBounds();
 };
 
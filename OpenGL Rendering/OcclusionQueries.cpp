@@ -0,0 +1,122 @@
+#include <OpenGL/gl.h>
+
+#include "OcclusionQueries.h"
+
+namespace
+{
+	// frames an object may go undrawn before its queries are released
+	const unsigned int FORGET_AFTER = 60;
+}
+
+OcclusionQueries::OcclusionQueries():frame(0)
+{
+	stats.tested = stats.occluded = stats.queries = 0;
+}
+
+OcclusionQueries::~OcclusionQueries()
+{
+	for(std::map<const void*, Entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+		glDeleteQueries(1, &i->second.query);
+}
+
+OcclusionQueries::Entry& OcclusionQueries::entry(const void* key)
+{
+	std::map<const void*, Entry>::iterator found = entries.find(key);
+	if(found != entries.end())
+	{
+		found->second.lastUsed = frame;
+		return found->second;
+	}
+	Entry& e = entries[key];
+	glGenQueries(1, &e.query);
+	e.pending = false;
+	// unknown objects are drawn
+	e.visible = true;
+	e.lastUsed = frame;
+	return e;
+}
+
+void OcclusionQueries::beginFrame()
+{
+	frame++;
+	stats.tested = stats.occluded = stats.queries = 0;
+	std::map<const void*, Entry>::iterator i = entries.begin();
+	while(i != entries.end())
+	{
+		Entry& e = i->second;
+		if(frame - e.lastUsed > FORGET_AFTER)
+		{
+			glDeleteQueries(1, &e.query);
+			entries.erase(i++);
+			continue;
+		}
+		if(e.pending)
+		{
+			GLuint available = 0;
+			glGetQueryObjectuiv(e.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			// a late result must not stall us; keep drawing until it comes
+			if(!available)
+				e.visible = true;
+			else
+			{
+				GLuint samples = 0;
+				glGetQueryObjectuiv(e.query, GL_QUERY_RESULT, &samples);
+				e.visible = samples > 0;
+				e.pending = false;
+			}
+		}
+		++i;
+	}
+}
+
+bool OcclusionQueries::isVisible(const void* key)
+{
+	Entry& e = entry(key);
+	stats.tested++;
+	if(!e.visible)
+		stats.occluded++;
+	return e.visible;
+}
+
+void OcclusionQueries::forget(const void* key)
+{
+	std::map<const void*, Entry>::iterator found = entries.find(key);
+	if(found == entries.end())
+		return;
+	glDeleteQueries(1, &found->second.query);
+	entries.erase(found);
+}
+
+void OcclusionQueries::beginQueries()
+{
+	glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_LIGHTING);
+}
+
+void OcclusionQueries::query(const void* key, const AABB& box)
+{
+	Entry& e = entry(key);
+	const float3& a = box.min;
+	const float3& b = box.max;
+	glBeginQuery(GL_SAMPLES_PASSED, e.query);
+	glBegin(GL_QUADS);
+	glVertex3f(a.x, a.y, a.z); glVertex3f(b.x, a.y, a.z); glVertex3f(b.x, b.y, a.z); glVertex3f(a.x, b.y, a.z);
+	glVertex3f(a.x, a.y, b.z); glVertex3f(a.x, b.y, b.z); glVertex3f(b.x, b.y, b.z); glVertex3f(b.x, a.y, b.z);
+	glVertex3f(a.x, a.y, a.z); glVertex3f(a.x, b.y, a.z); glVertex3f(a.x, b.y, b.z); glVertex3f(a.x, a.y, b.z);
+	glVertex3f(b.x, a.y, a.z); glVertex3f(b.x, a.y, b.z); glVertex3f(b.x, b.y, b.z); glVertex3f(b.x, b.y, a.z);
+	glVertex3f(a.x, a.y, a.z); glVertex3f(a.x, a.y, b.z); glVertex3f(b.x, a.y, b.z); glVertex3f(b.x, a.y, a.z);
+	glVertex3f(a.x, b.y, a.z); glVertex3f(b.x, b.y, a.z); glVertex3f(b.x, b.y, b.z); glVertex3f(a.x, b.y, b.z);
+	glEnd();
+	glEndQuery(GL_SAMPLES_PASSED);
+	e.pending = true;
+	stats.queries++;
+}
+
+void OcclusionQueries::endQueries()
+{
+	glPopAttrib();
+}
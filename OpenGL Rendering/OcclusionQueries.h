@@ -0,0 +1,61 @@
+#pragma once
+
+#include "AABB.h"
+#include <map>
+
+// Occlusion culling with hardware occlusion queries. After a part of the
+// scene has been drawn, the bounding box of each object is rasterized against
+// its depth, without touching color or depth, counting the samples that pass.
+// Waiting for that count would stall the pipeline, so it is only read back
+// the next frame: an object whose box showed no samples last frame is
+// skipped, and it reappears one frame late at worst. OpenGL 2.1 has no
+// conditional rendering that would let the GPU decide by itself.
+class OcclusionQueries
+{
+public:
+	struct Stats
+	{
+		unsigned int tested;	// objects with a result from last frame
+		unsigned int occluded;	// of those, skipped as hidden
+		unsigned int queries;	// issued this frame
+	};
+private:
+	struct Entry
+	{
+		unsigned int query;
+		bool pending;
+		bool visible;
+		unsigned int lastUsed;
+	};
+	std::map<const void*, Entry> entries;
+	unsigned int frame;
+	Stats stats;
+
+	Entry& entry(const void* key);
+public:
+	OcclusionQueries();
+	~OcclusionQueries();
+
+	// Collects last frame's results that have arrived, and forgets objects
+	// that have not been drawn for a while.
+	void beginFrame();
+
+	// false if the object's box was hidden last frame
+	bool isVisible(const void* key);
+
+	// Drops what is known about an object that is going away, so that one
+	// made later at the same address starts out visible.
+	void forget(const void* key);
+
+	// Tests box, in world space with the view matrix loaded, against the
+	// depth drawn so far. Issue queries between beginQueries() and
+	// endQueries(), which keep them from writing color or depth.
+	void beginQueries();
+	void query(const void* key, const AABB& box);
+	void endQueries();
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+};
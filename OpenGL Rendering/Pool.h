@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Objects of one type, kept in chunks of slots that never move, so pointers
+// to them stay valid while the pool grows. Creating takes the most recently
+// freed slot, whose memory is likely still in cache, and destroying puts it
+// back; both are O(1).
+// A handle names a slot and a generation of it. Every create and destroy
+// moves the slot's generation on, so a handle to a destroyed object no
+// longer resolves, even once its slot holds another one.
+template<typename T>
+class Pool
+{
+public:
+	struct Handle
+	{
+		unsigned int index;
+		unsigned int generation;	// even ones, as in a zeroed handle, never resolve
+	};
+private:
+	enum
+	{
+		CHUNK = 256,
+		NO_SLOT = 0xffffffff
+	};
+	struct Slot
+	{
+		// first, so that an object's address is its slot's
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		unsigned int index;
+		unsigned int generation;	// odd while an object lives here
+		unsigned int next;			// next free slot, or the object's place in live
+	};
+
+	std::vector<Slot*> chunks;
+	unsigned int slotCount;
+	unsigned int firstFree;
+	std::vector<T*> live;
+
+	Slot& slot(unsigned int index) const
+	{
+		return chunks[index / CHUNK][index % CHUNK];
+	}
+	static Slot& slotOf(const T* object)
+	{
+		return *reinterpret_cast<Slot*>(const_cast<T*>(object));
+	}
+public:
+	Pool():slotCount(0), firstFree(NO_SLOT){}
+	~Pool()
+	{
+		for(size_t i = 0; i < live.size(); i++)
+			live[i]->~T();
+		for(size_t i = 0; i < chunks.size(); i++)
+			delete[] chunks[i];
+	}
+	Pool(const Pool&) = delete;
+	Pool& operator=(const Pool&) = delete;
+
+	template<typename... Args> Handle create(Args&&... args)
+	{
+		unsigned int index = firstFree;
+		bool reused = index != NO_SLOT;
+		if(!reused)
+		{
+			if(slotCount % CHUNK == 0)
+				chunks.push_back(new Slot[CHUNK]);
+			index = slotCount;
+			Slot& fresh = slot(index);
+			fresh.index = index;
+			fresh.generation = 0;
+			fresh.next = NO_SLOT;
+			slotCount++;
+		}
+		Slot& s = slot(index);
+		T* object = new(&s.storage) T(std::forward<Args>(args)...);
+		if(reused)
+			firstFree = s.next;
+		s.generation++;
+		s.next = (unsigned int)live.size();
+		live.push_back(object);
+		Handle handle = {index, s.generation};
+		return handle;
+	}
+
+	// false if the handle was stale
+	bool destroy(Handle handle)
+	{
+		T* object = get(handle);
+		if(!object)
+			return false;
+		object->~T();
+		Slot& s = slot(handle.index);
+		s.generation++;
+		// the last live object fills the hole
+		T* last = live.back();
+		live[s.next] = last;
+		slotOf(last).next = s.next;
+		live.pop_back();
+		s.next = firstFree;
+		firstFree = handle.index;
+		return true;
+	}
+
+	// the object, or null once it has been destroyed
+	T* get(Handle handle) const
+	{
+		if(handle.index >= slotCount)
+			return nullptr;
+		Slot& s = slot(handle.index);
+		if(s.generation != handle.generation || !(handle.generation & 1))
+			return nullptr;
+		return reinterpret_cast<T*>(&s.storage);
+	}
+
+	// object must be alive, in this pool
+	Handle handleOf(const T* object) const
+	{
+		const Slot& s = slotOf(object);
+		Handle handle = {s.index, s.generation};
+		return handle;
+	}
+
+	// The live objects, packed; destroying one moves the last into its place.
+	size_t size() const
+	{
+		return live.size();
+	}
+	T* operator[](size_t i) const
+	{
+		return live[i];
+	}
+	typename std::vector<T*>::const_iterator begin() const
+	{
+		return live.begin();
+	}
+	typename std::vector<T*>::const_iterator end() const
+	{
+		return live.end();
+	}
+};
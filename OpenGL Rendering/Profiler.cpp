@@ -0,0 +1,212 @@
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <mutex>
+#include <new>
+
+#include "Profiler.h"
+
+namespace
+{
+	std::mutex registryLock;
+	std::vector<Profiler::Zone*> zones;
+	unsigned int frame = 0;
+
+	// timer queries are an extension to OpenGL 2.1; -1 until asked
+	int timerQueries = -1;
+	// the GPU zone being timed, as they cannot nest
+	Profiler::Zone* activeGpuZone = 0;
+
+	bool hasTimerQueries()
+	{
+		if(timerQueries < 0)
+		{
+			const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+			timerQueries = extensions && (strstr(extensions, "GL_EXT_timer_query") ||
+				strstr(extensions, "GL_ARB_timer_query")) ? 1 : 0;
+		}
+		return timerQueries == 1;
+	}
+
+	// by anything, since the program started
+	std::atomic<unsigned long long> allocations(0);
+	unsigned long long allocationsBefore = 0;	// at the start of this frame
+	unsigned int allocationHistory[Profiler::HISTORY];
+	unsigned long long framedAllocations = 0;	// by all closed frames
+	unsigned int worstAllocations = 0;
+
+	bool byTotal(const Profiler::Zone* a, const Profiler::Zone* b)
+	{
+		return a->totalMilliseconds > b->totalMilliseconds;
+	}
+}
+
+double Profiler::Zone::average() const
+{
+	unsigned int frames = std::min(frame, (unsigned int)HISTORY);
+	if(frames == 0)
+		return 0;
+	double sum = 0;
+	for(unsigned int i = 0; i < frames; i++)
+		sum += history[i];
+	return sum / frames;
+}
+
+#ifdef PROFILING
+void* operator new(size_t size)
+{
+	allocations++;
+	void* memory = malloc(size ? size : 1);
+	if(!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+#endif
+
+Profiler::Scope::Scope(Zone* zone):zone(zone), start(std::chrono::steady_clock::now())
+{
+}
+
+Profiler::Scope::~Scope()
+{
+	zone->frameNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	zone->frameCalls++;
+}
+
+Profiler::GpuScope::GpuScope(Zone* zone):zone(0)
+{
+	if(activeGpuZone || !hasTimerQueries())
+		return;
+	int slot = frame % GPU_LATENCY;
+	if(zone->queries[0] == 0)
+		glGenQueries(GPU_LATENCY, zone->queries);
+	glBeginQuery(GL_TIME_ELAPSED_EXT, zone->queries[slot]);
+	zone->pending[slot] = true;
+	zone->frameCalls++;
+	activeGpuZone = this->zone = zone;
+}
+
+Profiler::GpuScope::~GpuScope()
+{
+	if(!zone)
+		return;
+	glEndQuery(GL_TIME_ELAPSED_EXT);
+	activeGpuZone = 0;
+}
+
+Profiler::Zone* Profiler::zone(const char* name, bool gpu)
+{
+	std::lock_guard<std::mutex> lock(registryLock);
+	for(size_t i = 0; i < zones.size(); i++)
+		if(zones[i]->gpu == gpu && strcmp(zones[i]->name, name) == 0)
+			return zones[i];
+	Zone* zone = new Zone();
+	zone->name = name;
+	zone->gpu = gpu;
+	zone->frameNanoseconds = 0;
+	zone->frameCalls = 0;
+	zones.push_back(zone);
+	return zone;
+}
+
+std::vector<const Profiler::Zone*> Profiler::getZones()
+{
+	std::lock_guard<std::mutex> lock(registryLock);
+	return std::vector<const Zone*>(zones.begin(), zones.end());
+}
+
+unsigned int Profiler::getFrameCount()
+{
+	return frame;
+}
+
+double Profiler::averageAllocations()
+{
+	unsigned int frames = std::min(frame, (unsigned int)HISTORY);
+	if(frames == 0)
+		return 0;
+	double sum = 0;
+	for(unsigned int i = 0; i < frames; i++)
+		sum += allocationHistory[i];
+	return sum / frames;
+}
+
+unsigned int Profiler::getFrameAllocations()
+{
+	return frame ? allocationHistory[(frame - 1) % HISTORY] : 0;
+}
+
+void Profiler::endFrame()
+{
+	std::lock_guard<std::mutex> lock(registryLock);
+	unsigned long long now = allocations;
+	unsigned int frameAllocations = (unsigned int)(now - allocationsBefore);
+	allocationsBefore = now;
+	// the first frame also counts everything loaded before it
+	allocationHistory[frame % HISTORY] = frame > 0 ? frameAllocations : 0;
+	if(frame > 0)
+	{
+		framedAllocations += frameAllocations;
+		worstAllocations = std::max(worstAllocations, frameAllocations);
+	}
+	for(size_t i = 0; i < zones.size(); i++)
+	{
+		Zone& zone = *zones[i];
+		double milliseconds = 0;
+		if(!zone.gpu)
+			milliseconds = zone.frameNanoseconds.exchange(0) * 1e-6;
+		else
+		{
+			// the slot the next frame reuses, issued GPU_LATENCY - 1 frames ago
+			int slot = (frame + 1) % GPU_LATENCY;
+			if(zone.pending[slot])
+			{
+				GLuint nanoseconds = 0;
+				glGetQueryObjectuiv(zone.queries[slot], GL_QUERY_RESULT, &nanoseconds);
+				milliseconds = nanoseconds * 1e-6;
+				zone.pending[slot] = false;
+			}
+		}
+		zone.history[frame % HISTORY] = (float)milliseconds;
+		zone.totalMilliseconds += milliseconds;
+		zone.maxMilliseconds = std::max(zone.maxMilliseconds, milliseconds);
+		zone.totalCalls += zone.frameCalls.exchange(0);
+	}
+	frame++;
+}
+
+bool Profiler::writeReport(const char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if(!file)
+		return false;
+	std::vector<Zone*> sorted;
+	{
+		std::lock_guard<std::mutex> lock(registryLock);
+		sorted = zones;
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), byTotal);
+	fprintf(file, "%u frames\n\n", frame);
+	fprintf(file, "%-28s %4s %10s %12s %12s %12s\n", "zone", "", "calls", "total ms", "ms/frame", "max ms");
+	for(size_t i = 0; i < sorted.size(); i++)
+	{
+		const Zone& zone = *sorted[i];
+		fprintf(file, "%-28s %4s %10llu %12.2f %12.3f %12.3f\n", zone.name, zone.gpu ? "GPU" : "CPU",
+			zone.totalCalls, zone.totalMilliseconds, frame ? zone.totalMilliseconds / frame : 0.0,
+			zone.maxMilliseconds);
+	}
+	if(frame > 1)
+		fprintf(file, "\nheap allocations per frame: %.1f, at most %u\n",
+			(double)framedAllocations / (frame - 1), worstAllocations);
+	return fclose(file) == 0;
+}
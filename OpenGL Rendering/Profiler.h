@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+// Define NO_PROFILING to compile all the zones out.
+#ifndef NO_PROFILING
+#define PROFILING
+#endif
+
+// Frame profiler. PROFILE_ZONE("name") times the rest of the enclosing scope
+// on the CPU, on any thread. PROFILE_GPU("name") times the GL commands issued
+// in the rest of the scope on the GPU, with a timer query whose result is
+// read a few frames later, so as not to stall. GPU zones do not nest, and
+// each is timed once per frame. Names are string literals; every place using
+// the same name adds to the same zone.
+// endFrame() closes a frame. The frame's times join a rolling window for the
+// overlay, and the totals that writeReport() prints.
+// With profiling on, the global operator new is replaced by one that counts
+// heap allocations, so frames can be checked for allocating.
+class Profiler
+{
+public:
+	enum
+	{
+		HISTORY = 120,		// frames averaged for the overlay
+		GPU_LATENCY = 3		// frames before a timer query is read
+	};
+
+	struct Zone
+	{
+		const char* name;
+		bool gpu;
+		std::atomic<long long> frameNanoseconds;	// CPU time so far this frame
+		std::atomic<unsigned int> frameCalls;
+		float history[HISTORY];		// milliseconds, by frame
+		double totalMilliseconds;
+		double maxMilliseconds;
+		unsigned long long totalCalls;
+		unsigned int queries[GPU_LATENCY];
+		bool pending[GPU_LATENCY];
+
+		// milliseconds per frame over the rolling window
+		double average() const;
+	};
+
+	class Scope
+	{
+		Zone* zone;
+		std::chrono::steady_clock::time_point start;
+	public:
+		explicit Scope(Zone* zone);
+		~Scope();
+	};
+
+	class GpuScope
+	{
+		Zone* zone;
+	public:
+		explicit GpuScope(Zone* zone);
+		~GpuScope();
+	};
+
+	// the zone of that name, made on first use
+	static Zone* zone(const char* name, bool gpu);
+	// in order of first use
+	static std::vector<const Zone*> getZones();
+	static unsigned int getFrameCount();
+	// heap allocations, on any thread, per frame over the rolling window
+	static double averageAllocations();
+	// by the frame last closed
+	static unsigned int getFrameAllocations();
+
+	// On the GL thread, after the frame's last GL command.
+	static void endFrame();
+	// Per zone: calls, total time, and average and worst time per frame;
+	// then heap allocations per frame.
+	static bool writeReport(const char* filename);
+};
+
+#ifdef PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) \
+	static Profiler::Zone* PROFILE_CONCAT(profileZone, __LINE__) = Profiler::zone(name, false); \
+	Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileZone, __LINE__))
+#define PROFILE_GPU(name) \
+	static Profiler::Zone* PROFILE_CONCAT(profileZone, __LINE__) = Profiler::zone(name, true); \
+	Profiler::GpuScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileZone, __LINE__))
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU(name)
+#endif
@@ -0,0 +1,133 @@
+#include <OpenGL/gl.h>
+
+#include <vector>
+
+#include "Shader.h"
+
+Shader* Shader::active = 0;
+
+Shader::Shader(const char* vertexSource, const char* fragmentSource):program(0)
+{
+	GLuint vertexShader = compile(GL_VERTEX_SHADER, vertexSource);
+	GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, fragmentSource);
+	if(vertexShader && fragmentShader)
+	{
+		program = glCreateProgram();
+		glAttachShader(program, vertexShader);
+		glAttachShader(program, fragmentShader);
+		glLinkProgram(program);
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if(!linked)
+		{
+			GLint length = 0;
+			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+			std::vector<char> text(length + 1, '\0');
+			glGetProgramInfoLog(program, length, 0, &text[0]);
+			log += &text[0];
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	// the program keeps what it needs
+	if(vertexShader)
+		glDeleteShader(vertexShader);
+	if(fragmentShader)
+		glDeleteShader(fragmentShader);
+}
+
+Shader::~Shader()
+{
+	if(active == this)
+		useFixedFunction();
+	if(program)
+		glDeleteProgram(program);
+}
+
+unsigned int Shader::compile(unsigned int type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, 0);
+	glCompileShader(shader);
+	GLint compiled = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if(!compiled)
+	{
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		std::vector<char> text(length + 1, '\0');
+		glGetShaderInfoLog(shader, length, 0, &text[0]);
+		log += &text[0];
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+void Shader::use()
+{
+	glUseProgram(program);
+	active = this;
+}
+
+void Shader::useFixedFunction()
+{
+	glUseProgram(0);
+	active = 0;
+}
+
+int Shader::uniform(const char* name)
+{
+	std::map<std::string, int>::iterator found = uniforms.find(name);
+	if(found != uniforms.end())
+		return found->second;
+	int location = glGetUniformLocation(program, name);
+	uniforms[name] = location;
+	return location;
+}
+
+void Shader::set(const char* name, int value)
+{
+	glUniform1i(uniform(name), value);
+}
+
+void Shader::set(const char* name, float value)
+{
+	glUniform1f(uniform(name), value);
+}
+
+void Shader::set(const char* name, const float3& value)
+{
+	glUniform3f(uniform(name), value.x, value.y, value.z);
+}
+
+void Shader::set(const char* name, const float4x4& value)
+{
+	glUniformMatrix4fv(uniform(name), 1, GL_FALSE, value.data());
+}
+
+void Shader::setArray1(const char* name, const float* values, int count)
+{
+	glUniform1fv(uniform(name), count, values);
+}
+
+void Shader::setArray1(const char* name, const int* values, int count)
+{
+	glUniform1iv(uniform(name), count, values);
+}
+
+void Shader::setArray3(const char* name, const float* values, int count)
+{
+	glUniform3fv(uniform(name), count, values);
+}
+
+void Shader::setArray4(const char* name, const float* values, int count)
+{
+	glUniform4fv(uniform(name), count, values);
+}
+
+void Shader::setArray4x4(const char* name, const float4x4* values, int count)
+{
+	// matrices hold nothing but their 16 floats, so an array of them is one of floats
+	glUniformMatrix4fv(uniform(name), count, GL_FALSE, values[0].data());
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "float3.h"
+#include "float4x4.h"
+#include <map>
+#include <string>
+
+// GLSL program made of one vertex and one fragment shader. Uniform locations
+// are looked up once and cached by name. The program last put to use is
+// available through getActive(), so that materials can set their uniforms
+// without knowing who draws them.
+class Shader
+{
+	unsigned int program;
+	std::string log;
+	std::map<std::string, int> uniforms;
+
+	static Shader* active;
+
+	unsigned int compile(unsigned int type, const char* source);
+public:
+	Shader(const char* vertexSource, const char* fragmentSource);
+	~Shader();
+
+	// false if compiling or linking failed; getLog() tells why
+	bool isValid() const
+	{
+		return program != 0;
+	}
+	const std::string& getLog() const
+	{
+		return log;
+	}
+
+	void use();
+	// back to the fixed-function pipeline
+	static void useFixedFunction();
+	static Shader* getActive()
+	{
+		return active;
+	}
+
+	// -1 for uniforms the program does not use
+	int uniform(const char* name);
+
+	void set(const char* name, int value);
+	void set(const char* name, float value);
+	void set(const char* name, const float3& value);
+	void set(const char* name, const float4x4& value);
+	void setArray1(const char* name, const float* values, int count);
+	void setArray1(const char* name, const int* values, int count);
+	void setArray3(const char* name, const float* values, int count);
+	void setArray4(const char* name, const float* values, int count);
+	void setArray4x4(const char* name, const float4x4* values, int count);
+};
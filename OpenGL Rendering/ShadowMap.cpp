@@ -0,0 +1,227 @@
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "ShadowMap.h"
+
+#ifndef GL_TEXTURE_COMPARE_FAIL_VALUE_ARB
+#define GL_TEXTURE_COMPARE_FAIL_VALUE_ARB 0x80BF
+#endif
+
+namespace
+{
+	// how bright shadowed fragments stay where the driver lets us choose
+	const float SHADOW_BRIGHTNESS = 0.5f;
+}
+
+ShadowMap::ShadowMap(int size):size(size)
+{
+	glGenTextures(1, &depthTexture);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+	// linear filtering of a depth comparison is the hardware's 2x2 PCF
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// everything outside the map is lit
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	float white[] = {1, 1, 1, 1};
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_DEPTH_TEXTURE_MODE, GL_LUMINANCE);
+	const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+	if(extensions && strstr(extensions, "GL_ARB_shadow_ambient"))
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FAIL_VALUE_ARB, SHADOW_BRIGHTNESS);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffersEXT(1, &framebuffer);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, depthTexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
+
+ShadowMap::~ShadowMap()
+{
+	glDeleteFramebuffersEXT(1, &framebuffer);
+	glDeleteTextures(1, &depthTexture);
+}
+
+void ShadowMap::fit(const float3* points, int count, const float3& toLight, float casterReach)
+{
+	float3 center(0, 0, 0);
+	for(int i = 0; i < count; i++)
+		center += points[i];
+	center *= 1.0f / count;
+	float radius = 0;
+	for(int i = 0; i < count; i++)
+	{
+		float d = (points[i] - center).norm();
+		if(d > radius)
+			radius = d;
+	}
+	// a sphere keeps the map size fixed as the view turns
+	radius = ceilf(radius);
+
+	// the light's orientation only depends on its direction, so the texel
+	// grid stays put in the world and only the window over it moves
+	float3 l = toLight.normalized();
+	float3 up = fabsf(l.y) > 0.99f ? float3(0, 0, 1) : float3(0, 1, 0);
+	lightView = float4x4::lookAt(l, float3(0, 0, 0), up);
+
+	float3 c = lightView.transformPoint(center);
+	float texel = 2 * radius / size;
+	c.x = floorf(c.x / texel) * texel;
+	c.y = floorf(c.y / texel) * texel;
+	lightProj = float4x4::orthographic(c.x - radius, c.x + radius, c.y - radius, c.y + radius,
+		-(c.z + radius) - casterReach, -(c.z - radius));
+}
+
+float4x4 ShadowMap::getShadowMatrix() const
+{
+	// light clip space, then from [-1, 1] to [0, 1]
+	float4x4 bias = float4x4::translation(float3(0.5f, 0.5f, 0.5f)) * float4x4::scaling(float3(0.5f, 0.5f, 0.5f));
+	return bias * lightProj * lightView;
+}
+
+Frustum ShadowMap::getFrustum() const
+{
+	return Frustum::fromMatrix(lightProj * lightView);
+}
+
+void ShadowMap::begin()
+{
+	glPushAttrib(GL_ENABLE_BIT | GL_POLYGON_BIT | GL_COLOR_BUFFER_BIT | GL_VIEWPORT_BIT);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+	glViewport(0, 0, size, size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_BLEND);
+	// pushes depths back a little against shadow acne
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadMatrixf(lightProj.data());
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadMatrixf(lightView.data());
+}
+
+void ShadowMap::end()
+{
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	glPopAttrib();
+}
+
+void ShadowMap::bind(unsigned int textureUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	// with the view matrix loaded, eye linear generation yields world positions
+	float planes[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+	GLenum coords[4] = {GL_S, GL_T, GL_R, GL_Q};
+	GLenum gens[4] = {GL_TEXTURE_GEN_S, GL_TEXTURE_GEN_T, GL_TEXTURE_GEN_R, GL_TEXTURE_GEN_Q};
+	for(int i = 0; i < 4; i++)
+	{
+		glTexGeni(coords[i], GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+		glTexGenfv(coords[i], GL_EYE_PLANE, planes[i]);
+		glEnable(gens[i]);
+	}
+
+	glMatrixMode(GL_TEXTURE);
+	glLoadMatrixf(getShadowMatrix().data());
+	glMatrixMode(GL_MODELVIEW);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void ShadowMap::unbind(unsigned int textureUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glMatrixMode(GL_TEXTURE);
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glDisable(GL_TEXTURE_GEN_S);
+	glDisable(GL_TEXTURE_GEN_T);
+	glDisable(GL_TEXTURE_GEN_R);
+	glDisable(GL_TEXTURE_GEN_Q);
+	glDisable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void ShadowMap::bindTexture(unsigned int textureUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+ShadowCascades::ShadowCascades(int count, int size, float lambda)
+	:count(count < MAX_CASCADES ? count : (int)MAX_CASCADES),lambda(lambda),reuseFarCascade(false),frame(0)
+{
+	for(int i = 0; i < this->count; i++)
+	{
+		maps[i] = new ShadowMap(size);
+		memset(&stats[i], 0, sizeof(Stats));
+	}
+	computeSplits(0.1f, 100.0f);
+}
+
+ShadowCascades::~ShadowCascades()
+{
+	for(int i = 0; i < count; i++)
+		delete maps[i];
+}
+
+void ShadowCascades::computeSplits(float nearDist, float farDist)
+{
+	for(int i = 0; i <= count; i++)
+	{
+		float f = (float)i / count;
+		float logSplit = nearDist * powf(farDist / nearDist, f);
+		float uniformSplit = nearDist + (farDist - nearDist) * f;
+		splits[i] = lambda * logSplit + (1 - lambda) * uniformSplit;
+	}
+	splits[0] = nearDist;
+	splits[count] = farDist;
+}
+
+bool ShadowCascades::needsUpdate(int cascade) const
+{
+	// the first frame has nothing to reuse
+	if(!reuseFarCascade || count < 2 || cascade != count - 1 || frame == 0)
+		return true;
+	return frame % 2 == 0;
+}
+
+void ShadowCascades::bind(unsigned int firstUnit)
+{
+	for(int i = 0; i < count; i++)
+		maps[i]->bindTexture(firstUnit + i);
+}
+
+void ShadowCascades::unbind(unsigned int firstUnit)
+{
+	for(int i = 0; i < count; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "float3.h"
+#include "float4x4.h"
+#include "Frustum.h"
+
+// Depth map shadows from one directional light. The light's orthographic projection is fitted around a bounding
+// sphere of the part of the view that should receive shadows, and snapped to
+// whole texels so that the shadow edges do not swim as the camera moves.
+// Receivers sample the map with hardware depth comparison and bilinear
+// filtering (2x2 PCF), so shadows fall on any surface, not just the ground
+// plane: shaders through getShadowMatrix(), the fixed-function pipeline
+// through eye-linear texture coordinate generation.
+class ShadowMap
+{
+	int size;
+	unsigned int depthTexture;
+	unsigned int framebuffer;
+
+	float4x4 lightView;
+	float4x4 lightProj;
+public:
+	ShadowMap(int size);
+	~ShadowMap();
+
+	// Fits the light around the count world space points, seen from
+	// direction toLight. Casters up to casterReach beyond the points toward
+	// the light still cast shadows into them.
+	void fit(const float3* points, int count, const float3& toLight, float casterReach);
+
+	// world space frustum of the light, for culling casters
+	Frustum getFrustum() const;
+	const float4x4& getViewMatrix() const
+	{
+		return lightView;
+	}
+	const float4x4& getProjMatrix() const
+	{
+		return lightProj;
+	}
+	// world space to the map's texture coordinates and depth
+	float4x4 getShadowMatrix() const;
+
+	// Renders depth only into the map between begin() and end(); draw the
+	// casters in world space with the modelview matrix as left by begin().
+	void begin();
+	void end();
+
+	// Makes texture unit textureUnit darken shadowed fragments. Call with the
+	// camera's view matrix loaded as the modelview matrix.
+	void bind(unsigned int textureUnit);
+	void unbind(unsigned int textureUnit);
+
+	// just the depth texture, for a shader's sampler2DShadow
+	void bindTexture(unsigned int textureUnit);
+};
+
+// Cascaded shadow maps: the view is split in depth and each slice gets its
+// own shadow map, so nearby shadows stay sharp while distant casters are
+// still covered. Splits follow the practical scheme, a blend of logarithmic
+// and uniform spacing. The scene is drawn once; its shaders choose the map
+// for each fragment by its view depth.
+class ShadowCascades
+{
+public:
+	enum { MAX_CASCADES = 4 };
+
+	// what the last frame spent on each cascade
+	struct Stats
+	{
+		float nearDist;
+		float farDist;
+		unsigned int casters;	// objects drawn into the map
+		bool reused;			// the map was kept from an earlier frame
+		double milliseconds;	// CPU time spent issuing the depth pass
+	};
+private:
+	int count;
+	float lambda;
+	float splits[MAX_CASCADES + 1];
+	ShadowMap* maps[MAX_CASCADES];
+	Stats stats[MAX_CASCADES];
+	bool reuseFarCascade;
+	unsigned int frame;
+public:
+	// lambda 1 gives logarithmic splits, 0 uniform ones
+	ShadowCascades(int count, int size, float lambda);
+	~ShadowCascades();
+
+	void computeSplits(float nearDist, float farDist);
+
+	// The farthest cascade covers a lot of ground at low resolution, so it
+	// may be rendered every other frame only.
+	void setReuseFarCascade(bool reuse)
+	{
+		reuseFarCascade = reuse;
+	}
+	bool needsUpdate(int cascade) const;
+	void nextFrame()
+	{
+		frame++;
+	}
+
+	int getCount() const
+	{
+		return count;
+	}
+	float getSplit(int i) const
+	{
+		return splits[i];
+	}
+	ShadowMap& getMap(int cascade)
+	{
+		return *maps[cascade];
+	}
+
+	// the maps' depth textures to units firstUnit on, one per cascade
+	void bind(unsigned int firstUnit);
+	void unbind(unsigned int firstUnit);
+	Stats& getStats(int cascade)
+	{
+		return stats[cascade];
+	}
+	const Stats& getStats(int cascade) const
+	{
+		return stats[cascade];
+	}
+};
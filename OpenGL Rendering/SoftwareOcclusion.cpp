@@ -0,0 +1,305 @@
+#include "SoftwareOcclusion.h"
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+	// clip space position
+	struct Vertex
+	{
+		float x, y, z, w;
+	};
+
+	Vertex toClip(const float4x4& m, const float3& p)
+	{
+		Vertex v;
+		v.x = m.m[0] * p.x + m.m[4] * p.y + m.m[8] * p.z + m.m[12];
+		v.y = m.m[1] * p.x + m.m[5] * p.y + m.m[9] * p.z + m.m[13];
+		v.z = m.m[2] * p.x + m.m[6] * p.y + m.m[10] * p.z + m.m[14];
+		v.w = m.m[3] * p.x + m.m[7] * p.y + m.m[11] * p.z + m.m[15];
+		return v;
+	}
+
+	// distance in front of the near plane, z = -w
+	float nearDistance(const Vertex& v)
+	{
+		return v.z + v.w;
+	}
+
+	Vertex lerp(const Vertex& a, const Vertex& b, float t)
+	{
+		Vertex v = {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t};
+		return v;
+	}
+
+	// window x, y and normalized device depth
+	void toWindow(const Vertex& v, float* out)
+	{
+		float invW = 1.0f / v.w;
+		out[0] = (v.x * invW * 0.5f + 0.5f) * SoftwareOcclusion::WIDTH;
+		out[1] = (v.y * invW * 0.5f + 0.5f) * SoftwareOcclusion::HEIGHT;
+		out[2] = v.z * invW;
+	}
+}
+
+SoftwareOcclusion::SoftwareOcclusion(JobSystem& jobs):
+	ready(false), jobs(jobs), triangles(0), renderMilliseconds(0), tested(0), culled(0), testNanoseconds(0)
+{
+	for(int w = WIDTH, h = HEIGHT; w > 0 && h > 0; w /= 2, h /= 2)
+		levels.push_back(std::vector<float>(w * h, 1.0f));
+}
+
+SoftwareOcclusion::~SoftwareOcclusion()
+{
+	wait();
+}
+
+void SoftwareOcclusion::addOccluders(const std::vector<float3>& triangles)
+{
+	occluders.insert(occluders.end(), triangles.begin(), triangles.end());
+}
+
+void SoftwareOcclusion::addOccluder(const AABB& box)
+{
+	static const int faces[36] = {
+		0,2,1, 0,3,2, 4,5,6, 4,6,7, 0,1,5, 0,5,4,
+		1,2,6, 1,6,5, 2,3,7, 2,7,6, 3,0,4, 3,4,7 };
+	const float3& a = box.min;
+	const float3& b = box.max;
+	float3 corners[8] = {
+		float3(a.x,a.y,a.z), float3(b.x,a.y,a.z), float3(b.x,a.y,b.z), float3(a.x,a.y,b.z),
+		float3(a.x,b.y,a.z), float3(b.x,b.y,a.z), float3(b.x,b.y,b.z), float3(a.x,b.y,b.z) };
+	for(int i = 0; i < 36; i++)
+		occluders.push_back(corners[faces[i]]);
+}
+
+// Edge functions of the triangle are stepped over rows of four pixel
+// centers; pixels inside all three edges keep the nearer depth.
+void SoftwareOcclusion::rasterize(const float* a, const float* b, const float* c)
+{
+	float area = (b[0] - a[0]) * (c[1] - a[1]) - (c[0] - a[0]) * (b[1] - a[1]);
+	if(fabsf(area) < 1e-8f)
+		return;
+	// either winding is an occluder
+	if(area < 0)
+	{
+		std::swap(b, c);
+		area = -area;
+	}
+	int minX = std::max(0, (int)floorf(std::min(a[0], std::min(b[0], c[0]))));
+	int maxX = std::min(WIDTH - 1, (int)ceilf(std::max(a[0], std::max(b[0], c[0]))));
+	int minY = std::max(0, (int)floorf(std::min(a[1], std::min(b[1], c[1]))));
+	int maxY = std::min(HEIGHT - 1, (int)ceilf(std::max(a[1], std::max(b[1], c[1]))));
+	if(minX > maxX || minY > maxY)
+		return;
+
+	// edge i is inside where ex[i] * x + ey[i] * y + e0[i] >= 0
+	const float* v[3] = {a, b, c};
+	float ex[3], ey[3], e0[3];
+	for(int i = 0; i < 3; i++)
+	{
+		const float* p = v[i];
+		const float* q = v[(i + 1) % 3];
+		ex[i] = p[1] - q[1];
+		ey[i] = q[0] - p[0];
+		e0[i] = -(ex[i] * p[0] + ey[i] * p[1]);
+	}
+	float zx = ((b[2] - a[2]) * (c[1] - a[1]) - (c[2] - a[2]) * (b[1] - a[1])) / area;
+	float zy = ((c[2] - a[2]) * (b[0] - a[0]) - (b[2] - a[2]) * (c[0] - a[0])) / area;
+	float z0 = a[2] - zx * a[0] - zy * a[1];
+
+	std::vector<float>& depth = levels[0];
+	int startX = minX & ~3;
+	for(int y = minY; y <= maxY; y++)
+	{
+		float py = y + 0.5f;
+		float* row = &depth[y * WIDTH];
+#ifdef FLOAT3_SSE
+		__m128 px = _mm_add_ps(_mm_set1_ps(startX + 0.5f), _mm_set_ps(3, 2, 1, 0));
+		__m128 four = _mm_set1_ps(4);
+		__m128 zero = _mm_setzero_ps();
+		__m128 edge[3], edgeStep[3];
+		for(int i = 0; i < 3; i++)
+		{
+			edge[i] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ex[i]), px), _mm_set1_ps(ey[i] * py + e0[i]));
+			edgeStep[i] = _mm_set1_ps(ex[i] * 4);
+		}
+		__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zx), px), _mm_set1_ps(zy * py + z0));
+		__m128 zStep = _mm_mul_ps(_mm_set1_ps(zx), four);
+		for(int x = startX; x <= maxX; x += 4)
+		{
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)),
+				_mm_cmpge_ps(edge[2], zero));
+			if(_mm_movemask_ps(inside))
+			{
+				__m128 d = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(d, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, d)));
+			}
+			for(int i = 0; i < 3; i++)
+				edge[i] = _mm_add_ps(edge[i], edgeStep[i]);
+			z = _mm_add_ps(z, zStep);
+		}
+#else
+		for(int x = startX; x <= maxX; x++)
+		{
+			float px = x + 0.5f;
+			if(ex[0] * px + ey[0] * py + e0[0] < 0 || ex[1] * px + ey[1] * py + e0[1] < 0 ||
+				ex[2] * px + ey[2] * py + e0[2] < 0)
+				continue;
+			float z = zx * px + zy * py + z0;
+			if(z < row[x])
+				row[x] = z;
+		}
+#endif
+	}
+}
+
+void SoftwareOcclusion::buildPyramid()
+{
+	int w = WIDTH, h = HEIGHT;
+	for(size_t l = 1; l < levels.size(); l++)
+	{
+		const std::vector<float>& fine = levels[l - 1];
+		std::vector<float>& coarse = levels[l];
+		for(int y = 0; y < h / 2; y++)
+			for(int x = 0; x < w / 2; x++)
+			{
+				const float* p = &fine[2 * y * w + 2 * x];
+				coarse[y * (w / 2) + x] = std::max(std::max(p[0], p[1]), std::max(p[w], p[w + 1]));
+			}
+		w /= 2;
+		h /= 2;
+	}
+}
+
+void SoftwareOcclusion::update()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+	triangles = 0;
+	tested = culled = 0;
+	testNanoseconds = 0;
+	for(size_t t = 0; t + 2 < occluders.size(); t += 3)
+	{
+		Vertex in[3] = {toClip(viewProj, occluders[t]), toClip(viewProj, occluders[t + 1]), toClip(viewProj, occluders[t + 2])};
+		// clip against the near plane, which leaves up to four vertices
+		Vertex out[4];
+		int count = 0;
+		for(int i = 0; i < 3; i++)
+		{
+			const Vertex& p = in[i];
+			const Vertex& q = in[(i + 1) % 3];
+			float dp = nearDistance(p), dq = nearDistance(q);
+			if(dp >= 0)
+				out[count++] = p;
+			if((dp >= 0) != (dq >= 0))
+				out[count++] = lerp(p, q, dp / (dp - dq));
+		}
+		if(count < 3)
+			continue;
+		float window[4][3];
+		for(int i = 0; i < count; i++)
+			toWindow(out[i], window[i]);
+		for(int i = 2; i < count; i++)
+		{
+			rasterize(window[0], window[i - 1], window[i]);
+			triangles++;
+		}
+	}
+	buildPyramid();
+	ready = true;
+	renderMilliseconds = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void SoftwareOcclusion::render(const float4x4& viewProj)
+{
+	wait();
+	this->viewProj = viewProj;
+	update();
+}
+
+void SoftwareOcclusion::renderAsync(const float4x4& viewProj)
+{
+	wait();
+	this->viewProj = viewProj;
+	jobs.run([this]() { update(); }, rendering, "occluders");
+}
+
+void SoftwareOcclusion::wait()
+{
+	jobs.wait(rendering);
+}
+
+void SoftwareOcclusion::invalidate()
+{
+	wait();
+	ready = false;
+}
+
+bool SoftwareOcclusion::isOccluded(const AABB& box)
+{
+	if(!ready || box.isEmpty())
+		return false;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	tested++;
+	const float3& a = box.min;
+	const float3& b = box.max;
+	float minX = WIDTH, maxX = 0, minY = HEIGHT, maxY = 0, minZ = 1;
+	bool hidden = true;
+	for(int i = 0; i < 8 && hidden; i++)
+	{
+		float3 corner(i & 1 ? b.x : a.x, i & 2 ? b.y : a.y, i & 4 ? b.z : a.z);
+		Vertex v = toClip(viewProj, corner);
+		// boxes reaching past the near plane are not tested
+		if(nearDistance(v) <= 0)
+		{
+			hidden = false;
+			break;
+		}
+		float window[3];
+		toWindow(v, window);
+		minX = std::min(minX, window[0]);
+		maxX = std::max(maxX, window[0]);
+		minY = std::min(minY, window[1]);
+		maxY = std::max(maxY, window[1]);
+		minZ = std::min(minZ, window[2]);
+	}
+	if(hidden)
+	{
+		int x0 = std::max(0, (int)floorf(minX)), x1 = std::min(WIDTH - 1, (int)floorf(maxX));
+		int y0 = std::max(0, (int)floorf(minY)), y1 = std::min(HEIGHT - 1, (int)floorf(maxY));
+		// off screen boxes are left to frustum culling
+		if(x0 > x1 || y0 > y1)
+			hidden = false;
+		else
+		{
+			int level = 0;
+			while(level + 1 < (int)levels.size() && std::max(x1 - x0, y1 - y0) >> level > 2)
+				level++;
+			int w = WIDTH >> level;
+			const std::vector<float>& depth = levels[level];
+			for(int y = y0 >> level; y <= y1 >> level && hidden; y++)
+				for(int x = x0 >> level; x <= x1 >> level; x++)
+					if(minZ <= depth[y * w + x])
+					{
+						hidden = false;
+						break;
+					}
+		}
+	}
+	if(hidden)
+		culled++;
+	testNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	return hidden;
+}
+
+SoftwareOcclusion::Stats SoftwareOcclusion::getStats() const
+{
+	Stats stats = {triangles, tested, culled, renderMilliseconds, testNanoseconds * 1e-6};
+	return stats;
+}
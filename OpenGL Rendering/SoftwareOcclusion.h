@@ -0,0 +1,74 @@
+#pragma once
+
+#include "float3.h"
+#include "float4x4.h"
+#include "AABB.h"
+#include "JobSystem.h"
+#include <atomic>
+#include <vector>
+
+// Occlusion culling on the CPU. A few large occluders, given as triangles
+// that lie inside the real geometry, are rasterized into a small depth buffer,
+// four pixels at a time with SSE. A pyramid of coarser levels keeps the
+// farthest depth of each 2x2 block below, so a bounding box is tested by
+// reading a handful of texels from the level where its screen rectangle is
+// a few texels wide: it is hidden if it is behind all of them.
+// Unlike hardware queries there is no waiting on the GPU, and the buffer can
+// be drawn as a job while the simulation steps. Once drawn, boxes may be
+// tested from any number of jobs at once.
+class SoftwareOcclusion
+{
+public:
+	enum
+	{
+		WIDTH = 256,
+		HEIGHT = 256
+	};
+
+	struct Stats
+	{
+		unsigned int triangles;		// occluder triangles drawn, after near clipping
+		unsigned int tested;		// boxes tested since the buffer was drawn
+		unsigned int culled;		// of those, found hidden
+		double renderMilliseconds;	// drawing the occluders and the pyramid
+		double testMilliseconds;	// testing the boxes, summed over all threads
+	};
+private:
+	std::vector<float3> occluders;
+	std::vector<std::vector<float> > levels;
+	float4x4 viewProj;
+	bool ready;
+	JobSystem& jobs;
+	JobSystem::Counter rendering;
+	unsigned int triangles;
+	double renderMilliseconds;
+	std::atomic<unsigned int> tested;
+	std::atomic<unsigned int> culled;
+	std::atomic<long long> testNanoseconds;
+
+	void rasterize(const float* a, const float* b, const float* c);
+	void buildPyramid();
+	// draws the occluders through viewProj
+	void update();
+public:
+	explicit SoftwareOcclusion(JobSystem& jobs);
+	~SoftwareOcclusion();
+
+	// world space triangles, three points each
+	void addOccluders(const std::vector<float3>& triangles);
+	void addOccluder(const AABB& box);
+
+	// Draws the occluders as seen through viewProj.
+	void render(const float4x4& viewProj);
+	// render() as a job; wait() before testing
+	void renderAsync(const float4x4& viewProj);
+	void wait();
+	// Forgets what was drawn: nothing is occluded until render() again, so a
+	// buffer left from an older view is never tested against.
+	void invalidate();
+
+	// true if box is certainly hidden from the view last rendered
+	bool isOccluded(const AABB& box);
+
+	Stats getStats() const;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "float3.h"
+#include <vector>
+#include <unordered_map>
+#include <math.h>
+
+// Uniform grid over the x/z plane, hashed so that the island can be any size.
+// Each cell keeps the ids (entities) whose position falls into it together
+// with that position, so a query touches only a few small contiguous arrays.
+class SpatialHash
+{
+    struct Entry
+    {
+        unsigned int id;
+        float x;
+        float z;
+        float radius;
+    };
+
+    float cellSize;
+    float oneOverCellSize;
+    float maxRadius;
+    std::unordered_map<unsigned long long, std::vector<Entry> > cells;
+
+    int cellCoord(float v) const {
+        return (int)floorf(v * oneOverCellSize);
+    }
+    static unsigned long long key(int cx, int cz) {
+        return ((unsigned long long)(unsigned int)cx << 32) | (unsigned int)cz;
+    }
+public:
+    SpatialHash(float cellSize):cellSize(cellSize),oneOverCellSize(1.0f / cellSize),maxRadius(0){}
+
+    void insert(unsigned int id, const float3& position, float radius) {
+        Entry entry = {id, position.x, position.z, radius};
+        cells[key(cellCoord(position.x), cellCoord(position.z))].push_back(entry);
+        if(radius > maxRadius)
+            maxRadius = radius;
+    }
+
+    // position must be the one the id was inserted with
+    void remove(unsigned int id, const float3& position) {
+        std::unordered_map<unsigned long long, std::vector<Entry> >::iterator cell =
+            cells.find(key(cellCoord(position.x), cellCoord(position.z)));
+        if(cell == cells.end()) return;
+        std::vector<Entry>& entries = cell->second;
+        for(size_t i = 0; i < entries.size(); i++) {
+            if(entries[i].id == id) {
+                entries[i] = entries.back();
+                entries.pop_back();
+                break;
+            }
+        }
+        if(entries.empty())
+            cells.erase(cell);
+    }
+
+    float getCellSize() const {
+        return cellSize;
+    }
+
+    void clear() {
+        cells.clear();
+        maxRadius = 0;
+    }
+
+    // Appends every id whose own radius reaches p on the x/z plane.
+    template<typename Container>
+    void query(const float3& p, Container& hits) const {
+        int minX = cellCoord(p.x - maxRadius);
+        int maxX = cellCoord(p.x + maxRadius);
+        int minZ = cellCoord(p.z - maxRadius);
+        int maxZ = cellCoord(p.z + maxRadius);
+        for(int cx = minX; cx <= maxX; cx++) {
+            for(int cz = minZ; cz <= maxZ; cz++) {
+                std::unordered_map<unsigned long long, std::vector<Entry> >::const_iterator cell =
+                    cells.find(key(cx, cz));
+                if(cell == cells.end()) continue;
+                const std::vector<Entry>& entries = cell->second;
+                for(size_t i = 0; i < entries.size(); i++) {
+                    float dx = entries[i].x - p.x;
+                    float dz = entries[i].z - p.z;
+                    if(dx*dx + dz*dz < entries[i].radius * entries[i].radius)
+                        hits.push_back(entries[i].id);
+                }
+            }
+        }
+    }
+};
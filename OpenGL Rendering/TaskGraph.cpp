@@ -0,0 +1,101 @@
+#include "TaskGraph.h"
+#include <new>
+
+namespace
+{
+	// the task whose work, or child, this thread is running
+	__thread void* currentTask = 0;
+}
+
+TaskGraph::TaskGraph(JobSystem& jobs):jobs(jobs)
+{
+}
+
+TaskGraph::~TaskGraph()
+{
+	clear();
+}
+
+TaskGraph::Task TaskGraph::add(const char* name, const JobSystem::Job& work)
+{
+	Node* node = new Node();
+	node->name = name;
+	node->work = work;
+	node->dependencies = 0;
+	nodes.push_back(node);
+	return (Task)nodes.size() - 1;
+}
+
+void TaskGraph::depend(Task task, Task on)
+{
+	nodes[on]->dependents.push_back(task);
+	nodes[task]->dependencies++;
+}
+
+void TaskGraph::clear()
+{
+	for(size_t i = 0; i < nodes.size(); i++)
+		delete nodes[i];
+	nodes.clear();
+}
+
+void TaskGraph::start(Task task)
+{
+	Node* node = nodes[task];
+	jobs.run([this, node]()
+	{
+		void* outer = currentTask;
+		currentTask = node;
+		node->work();
+		currentTask = outer;
+		finish(node);
+	}, running, node->name);
+}
+
+// The last of a task's work and children to end releases its dependents.
+void TaskGraph::finish(Node* node)
+{
+	if(--node->unfinished > 0)
+		return;
+	for(size_t i = 0; i < node->dependents.size(); i++)
+		if(--nodes[node->dependents[i]]->waiting == 0)
+			start(node->dependents[i]);
+}
+
+void TaskGraph::spawn(const char* name, const JobSystem::Job& child)
+{
+	Node* parent = (Node*)currentTask;
+	// outside a task there is nothing to wait for the child
+	if(!parent)
+	{
+		child();
+		return;
+	}
+	parent->unfinished++;
+	void* memory = jobs.getArena().allocate(sizeof(Child), alignof(Child));
+	Child* spawned = new(memory) Child{parent, child};
+	jobs.run([this, spawned]()
+	{
+		// grandchildren belong to the same task
+		Node* parent = spawned->parent;
+		void* outer = currentTask;
+		currentTask = parent;
+		spawned->work();
+		currentTask = outer;
+		spawned->~Child();
+		finish(parent);
+	}, running, name);
+}
+
+void TaskGraph::run()
+{
+	for(size_t i = 0; i < nodes.size(); i++)
+	{
+		nodes[i]->waiting = nodes[i]->dependencies;
+		nodes[i]->unfinished = 1;
+	}
+	for(size_t i = 0; i < nodes.size(); i++)
+		if(nodes[i]->dependencies == 0)
+			start((Task)i);
+	jobs.wait(running);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "JobSystem.h"
+#include <atomic>
+#include <vector>
+
+// Work split into named tasks, each run as a job once the tasks it depends
+// on have finished. Nothing blocks on a dependency: whichever thread finishes
+// a task's last dependency queues the task. A task may spawn children from
+// inside its work; it only counts as finished, and releases the tasks that
+// depend on it, once its children are done too.
+// The graph is built once and can be run any number of times.
+class TaskGraph
+{
+public:
+	typedef int Task;
+private:
+	struct Node
+	{
+		const char* name;
+		JobSystem::Job work;
+		std::vector<Task> dependents;
+		int dependencies;
+		std::atomic<int> waiting;		// dependencies not finished yet this run
+		std::atomic<int> unfinished;	// the work itself and its running children
+	};
+	// kept in the spawning thread's frame arena, so that the job running it
+	// is small enough for std::function to hold without allocating
+	struct Child
+	{
+		Node* parent;
+		JobSystem::Job work;
+	};
+
+	JobSystem& jobs;
+	std::vector<Node*> nodes;
+	JobSystem::Counter running;
+
+	void start(Task task);
+	void finish(Node* node);
+public:
+	explicit TaskGraph(JobSystem& jobs);
+	~TaskGraph();
+
+	// name must outlive the graph, as it labels the task in traces
+	Task add(const char* name, const JobSystem::Job& work);
+	// task runs only after on has finished
+	void depend(Task task, Task on);
+	void clear();
+
+	// Called from inside one of this graph's tasks: runs child as a job that
+	// belongs to that task. Elsewhere child just runs at once. The child is
+	// kept in the job system's frame arenas, which must not be reset while
+	// the graph runs.
+	void spawn(const char* name, const JobSystem::Job& child);
+	// Spawns work(begin, end) over [0, count) in chunks of grain items.
+	template<typename Work> void spawnFor(const char* name, int count, int grain, const Work& work)
+	{
+		for(int begin = 0; begin < count; begin += grain)
+		{
+			int end = begin + grain < count ? begin + grain : count;
+			spawn(name, [work, begin, end]() { work(begin, end); });
+		}
+	}
+
+	// Runs every task once and returns when all have finished, running
+	// jobs meanwhile.
+	void run();
+};
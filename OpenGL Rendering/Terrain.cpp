@@ -0,0 +1,349 @@
+#include <OpenGL/gl.h>
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#include "Terrain.h"
+
+namespace
+{
+	// position, normal, texcoord
+	const int VERTEX_FLOATS = 8;
+	const int REFINE_STEPS = 8;
+
+	// Part of origin + t*dir, t in [tEnter, tExit], inside box. A ray parallel
+	// to a slab has an infinite inverse and still clips correctly.
+	bool clipRay(const AABB& box, const float3& origin, const float3& dir, float& tEnter, float& tExit)
+	{
+		const float* o = &origin.x;
+		const float* d = &dir.x;
+		const float* lo = &box.min.x;
+		const float* hi = &box.max.x;
+		for(int axis = 0; axis < 3; axis++)
+		{
+			if(d[axis] == 0)
+			{
+				if(o[axis] < lo[axis] || o[axis] > hi[axis])
+					return false;
+				continue;
+			}
+			float t0 = (lo[axis] - o[axis]) / d[axis];
+			float t1 = (hi[axis] - o[axis]) / d[axis];
+			if(t0 > t1) { float tmp = t0; t0 = t1; t1 = tmp; }
+			if(t0 > tEnter) tEnter = t0;
+			if(t1 < tExit) tExit = t1;
+			if(tEnter > tExit)
+				return false;
+		}
+		return true;
+	}
+}
+
+Terrain::Terrain(int chunksPerSide, int quadsPerChunk, float spacing, float (*height)(float x, float z))
+	:chunksPerSide(chunksPerSide),quadsPerChunk(quadsPerChunk),spacing(spacing),
+	vertexBuffer(0),indexBuffer(0),trianglesDrawn(0)
+{
+	samplesPerSide = chunksPerSide * quadsPerChunk + 1;
+	origin = -0.5f * (samplesPerSide - 1) * spacing;
+	skirtDepth = quadsPerChunk * spacing * 0.25f;
+	lodDistance = quadsPerChunk * spacing;
+
+	heights.resize(samplesPerSide * samplesPerSide);
+	for(int j = 0; j < samplesPerSide; j++)
+		for(int i = 0; i < samplesPerSide; i++)
+			heights[j * samplesPerSide + i] = height(origin + i * spacing, origin + j * spacing);
+
+	for(int cz = 0; cz < chunksPerSide; cz++)
+	{
+		for(int cx = 0; cx < chunksPerSide; cx++)
+		{
+			Chunk chunk;
+			for(int j = 0; j <= quadsPerChunk; j++)
+			{
+				for(int i = 0; i <= quadsPerChunk; i++)
+				{
+					int si = cx * quadsPerChunk + i;
+					int sj = cz * quadsPerChunk + j;
+					chunk.bounds.extend(float3(origin + si * spacing, sample(si, sj), origin + sj * spacing));
+				}
+			}
+			chunk.firstVertex = 0;
+			chunk.lod = -1;
+			bounds.extend(chunk.bounds);
+			chunks.push_back(chunk);
+		}
+	}
+
+	buildBuffers();
+}
+
+Terrain::~Terrain()
+{
+	if(vertexBuffer)
+		glDeleteBuffers(1, &vertexBuffer);
+	if(indexBuffer)
+		glDeleteBuffers(1, &indexBuffer);
+}
+
+float Terrain::sample(int i, int j) const
+{
+	return heights[j * samplesPerSide + i];
+}
+
+// Every chunk gets its own grid of vertices followed by its skirt, so all
+// chunks share the same index lists. Texture coordinates run from 0 to 1
+// across a chunk to keep them small however far the terrain reaches.
+void Terrain::buildBuffers()
+{
+	int q = quadsPerChunk;
+	int gridVertices = (q + 1) * (q + 1);
+	int vertsPerChunk = gridVertices + 4 * (q + 1);
+
+	std::vector<float> vertices;
+	vertices.reserve(chunks.size() * vertsPerChunk * VERTEX_FLOATS);
+	for(int cz = 0; cz < chunksPerSide; cz++)
+	{
+		for(int cx = 0; cx < chunksPerSide; cx++)
+		{
+			chunks[cz * chunksPerSide + cx].firstVertex = (unsigned int)(vertices.size() / VERTEX_FLOATS);
+			// grid, then the four skirt edges: z min, x max, z max, x min
+			for(int part = 0; part < 5; part++)
+			{
+				int rows = part == 0 ? q + 1 : 1;
+				for(int j = 0; j < rows; j++)
+				{
+					for(int k = 0; k <= q; k++)
+					{
+						int i = k;
+						int jj = j;
+						float drop = 0;
+						if(part > 0)
+						{
+							drop = skirtDepth;
+							if(part == 1) { i = k; jj = 0; }
+							else if(part == 2) { i = q; jj = k; }
+							else if(part == 3) { i = k; jj = q; }
+							else { i = 0; jj = k; }
+						}
+						int si = cx * q + i;
+						int sj = cz * q + jj;
+						float x = origin + si * spacing;
+						float z = origin + sj * spacing;
+						float3 n = normalAt(x, z);
+						vertices.push_back(x);
+						vertices.push_back(sample(si, sj) - drop);
+						vertices.push_back(z);
+						vertices.push_back(n.x);
+						vertices.push_back(n.y);
+						vertices.push_back(n.z);
+						vertices.push_back((float)i / q);
+						vertices.push_back((float)jj / q);
+					}
+				}
+			}
+		}
+	}
+
+	std::vector<unsigned short> indices;
+	for(int step = 1; step <= q; step *= 2)
+	{
+		LodRange range;
+		range.firstIndex = (unsigned int)indices.size();
+		for(int j = 0; j < q; j += step)
+		{
+			for(int i = 0; i < q; i += step)
+			{
+				unsigned short a = (unsigned short)(j * (q + 1) + i);
+				unsigned short b = (unsigned short)(j * (q + 1) + i + step);
+				unsigned short c = (unsigned short)((j + step) * (q + 1) + i);
+				unsigned short d = (unsigned short)((j + step) * (q + 1) + i + step);
+				indices.push_back(a); indices.push_back(c); indices.push_back(b);
+				indices.push_back(b); indices.push_back(c); indices.push_back(d);
+			}
+		}
+		for(int edge = 0; edge < 4; edge++)
+		{
+			unsigned short skirt = (unsigned short)(gridVertices + edge * (q + 1));
+			for(int k = 0; k < q; k += step)
+			{
+				unsigned short top0, top1;
+				if(edge == 0) { top0 = (unsigned short)k; top1 = (unsigned short)(k + step); }
+				else if(edge == 1) { top0 = (unsigned short)(k * (q + 1) + q); top1 = (unsigned short)((k + step) * (q + 1) + q); }
+				else if(edge == 2) { top0 = (unsigned short)(q * (q + 1) + k); top1 = (unsigned short)(q * (q + 1) + k + step); }
+				else { top0 = (unsigned short)(k * (q + 1)); top1 = (unsigned short)((k + step) * (q + 1)); }
+				unsigned short bottom0 = (unsigned short)(skirt + k);
+				unsigned short bottom1 = (unsigned short)(skirt + k + step);
+				indices.push_back(top0); indices.push_back(bottom0); indices.push_back(top1);
+				indices.push_back(top1); indices.push_back(bottom0); indices.push_back(bottom1);
+			}
+		}
+		range.indexCount = (unsigned int)indices.size() - range.firstIndex;
+		lods.push_back(range);
+	}
+
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+float Terrain::heightAt(float x, float z) const
+{
+	float fx = (x - origin) / spacing;
+	float fz = (z - origin) / spacing;
+	float last = (float)(samplesPerSide - 1);
+	fx = fx < 0 ? 0 : (fx > last ? last : fx);
+	fz = fz < 0 ? 0 : (fz > last ? last : fz);
+	int i = (int)fx;
+	int j = (int)fz;
+	if(i > samplesPerSide - 2) i = samplesPerSide - 2;
+	if(j > samplesPerSide - 2) j = samplesPerSide - 2;
+	float u = fx - i;
+	float v = fz - j;
+	const float* row0 = &heights[j * samplesPerSide + i];
+	const float* row1 = row0 + samplesPerSide;
+	float h0 = row0[0] + (row0[1] - row0[0]) * u;
+	float h1 = row1[0] + (row1[1] - row1[0]) * u;
+	return h0 + (h1 - h0) * v;
+}
+
+float3 Terrain::normalAt(float x, float z) const
+{
+	float dx = heightAt(x - spacing, z) - heightAt(x + spacing, z);
+	float dz = heightAt(x, z - spacing) - heightAt(x, z + spacing);
+	return float3(dx, 2 * spacing, dz).normalize();
+}
+
+// Marches along the ray in half-sample steps and refines the first step that
+// ends below the surface by bisection.
+bool Terrain::intersect(const float3& rayOrigin, const float3& dir, float tMax, float& t) const
+{
+	float tEnter = 0;
+	float tExit = tMax;
+	if(!clipRay(bounds, rayOrigin, dir, tEnter, tExit))
+		return false;
+	float length = dir.norm();
+	if(length == 0)
+		return false;
+	float step = 0.5f * spacing / length;
+
+	float tPrev = tEnter;
+	float3 p = rayOrigin + dir * tPrev;
+	if(p.y <= heightAt(p.x, p.z))
+	{
+		if(tPrev <= 0)
+			return false;
+		t = tPrev;
+		return true;
+	}
+	while(tPrev < tExit)
+	{
+		float tNext = tPrev + step < tExit ? tPrev + step : tExit;
+		p = rayOrigin + dir * tNext;
+		if(p.y <= heightAt(p.x, p.z))
+		{
+			float lo = tPrev;
+			float hi = tNext;
+			for(int k = 0; k < REFINE_STEPS; k++)
+			{
+				float mid = 0.5f * (lo + hi);
+				float3 m = rayOrigin + dir * mid;
+				if(m.y <= heightAt(m.x, m.z))
+					hi = mid;
+				else
+					lo = mid;
+			}
+			t = hi;
+			return true;
+		}
+		tPrev = tNext;
+	}
+	return false;
+}
+
+// Each coarse vertex takes the lowest sample of the coarse cells around it,
+// so every coarse triangle lies below all the samples of its own cell.
+void Terrain::getOccluder(int step, std::vector<float3>& triangles) const
+{
+	int cells = (samplesPerSide - 1) / step;
+	std::vector<float> low((cells + 1) * (cells + 1));
+	for(int J = 0; J <= cells; J++)
+		for(int I = 0; I <= cells; I++)
+		{
+			int i0 = std::max(0, (I - 1) * step), i1 = std::min(samplesPerSide - 1, (I + 1) * step);
+			int j0 = std::max(0, (J - 1) * step), j1 = std::min(samplesPerSide - 1, (J + 1) * step);
+			float h = sample(i0, j0);
+			for(int j = j0; j <= j1; j++)
+				for(int i = i0; i <= i1; i++)
+					h = std::min(h, sample(i, j));
+			low[J * (cells + 1) + I] = h;
+		}
+	float cellSize = step * spacing;
+	for(int J = 0; J < cells; J++)
+		for(int I = 0; I < cells; I++)
+		{
+			float x0 = origin + I * cellSize, x1 = x0 + cellSize;
+			float z0 = origin + J * cellSize, z1 = z0 + cellSize;
+			float3 p00(x0, low[J * (cells + 1) + I], z0);
+			float3 p10(x1, low[J * (cells + 1) + I + 1], z0);
+			float3 p01(x0, low[(J + 1) * (cells + 1) + I], z1);
+			float3 p11(x1, low[(J + 1) * (cells + 1) + I + 1], z1);
+			triangles.push_back(p00); triangles.push_back(p01); triangles.push_back(p10);
+			triangles.push_back(p10); triangles.push_back(p01); triangles.push_back(p11);
+		}
+}
+
+void Terrain::selectLod(const float3& eye, const Frustum& frustum)
+{
+	int maxLod = (int)lods.size() - 1;
+	trianglesDrawn = 0;
+	for(unsigned int c = 0; c < chunks.size(); c++)
+	{
+		Chunk& chunk = chunks[c];
+		if(!frustum.intersects(chunk.bounds))
+		{
+			chunk.lod = -1;
+			continue;
+		}
+		float distance = (chunk.bounds.clamp(eye) - eye).norm();
+		int lod = 0;
+		if(distance >= lodDistance)
+			lod = (int)log2f(distance / lodDistance) + 1;
+		chunk.lod = lod < maxLod ? lod : maxLod;
+		trianglesDrawn += lods[chunk.lod].indexCount / 3;
+	}
+}
+
+void Terrain::draw()
+{
+	const GLsizei stride = VERTEX_FLOATS * sizeof(float);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	for(unsigned int c = 0; c < chunks.size(); c++)
+	{
+		const Chunk& chunk = chunks[c];
+		if(chunk.lod < 0)
+			continue;
+		const char* base = (const char*)0 + chunk.firstVertex * stride;
+		glVertexPointer(3, GL_FLOAT, stride, base);
+		glNormalPointer(GL_FLOAT, stride, base + 3 * sizeof(float));
+		glTexCoordPointer(2, GL_FLOAT, stride, base + 6 * sizeof(float));
+		const LodRange& range = lods[chunk.lod];
+		glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_SHORT,
+			(const char*)0 + range.firstIndex * sizeof(unsigned short));
+	}
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "float3.h"
+#include "AABB.h"
+#include "Frustum.h"
+#include <vector>
+
+// Heightfield terrain centered on the origin, cut into square chunks.
+// Each chunk is drawn at a level of detail picked from its distance to the
+// viewer (geomipmapping): level l keeps every 2^l-th sample. Chunks carry a
+// skirt hanging below their border that hides the cracks between neighbours
+// of different levels. Chunks outside the view frustum are not drawn, so the
+// triangles per frame stay bounded however large the terrain gets.
+class Terrain
+{
+	struct Chunk
+	{
+		AABB bounds;
+		unsigned int firstVertex;
+		int lod;		// -1 when not drawn this frame
+	};
+
+	struct LodRange
+	{
+		unsigned int firstIndex;
+		unsigned int indexCount;
+	};
+
+	int chunksPerSide;
+	int quadsPerChunk;
+	int samplesPerSide;
+	float spacing;
+	float origin;			// world x and z of sample 0
+	float skirtDepth;
+	float lodDistance;		// chunks closer than this get full detail
+
+	std::vector<float> heights;		// samplesPerSide * samplesPerSide, row by row along x
+	std::vector<Chunk> chunks;
+	std::vector<LodRange> lods;
+	AABB bounds;
+
+	unsigned int vertexBuffer;
+	unsigned int indexBuffer;
+	unsigned int trianglesDrawn;
+
+	float sample(int i, int j) const;
+	void buildBuffers();
+public:
+	// height gives the terrain height at a world x, z
+	Terrain(int chunksPerSide, int quadsPerChunk, float spacing, float (*height)(float x, float z));
+	~Terrain();
+
+	// bilinear height at world x, z; clamped to the border outside the terrain
+	float heightAt(float x, float z) const;
+	float3 normalAt(float x, float z) const;
+
+	// first point of origin + t*dir, t in (0, tMax], at or below the surface
+	bool intersect(const float3& origin, const float3& dir, float tMax, float& t) const;
+
+	// picks the level of detail of every chunk for a viewer at eye, and culls
+	// the chunks outside frustum; both are in the terrain's model space
+	void selectLod(const float3& eye, const Frustum& frustum);
+	void draw();
+
+	// Appends the triangles of a coarse mesh with a vertex every step samples,
+	// in model space, that stays at or below the surface everywhere, so that
+	// whatever it hides is hidden by the terrain too.
+	void getOccluder(int step, std::vector<float3>& triangles) const;
+
+	const AABB& getBounds() const
+	{
+		return bounds;
+	}
+	unsigned int getTrianglesDrawn() const
+	{
+		return trianglesDrawn;
+	}
+	float getSize() const
+	{
+		return chunksPerSide * quadsPerChunk * spacing;
+	}
+};
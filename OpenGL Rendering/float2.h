@@ -15,7 +15,7 @@ public:
 	}
 
 
-	float2(float x, float y):x(x),y(y){}
+	constexpr float2(float x, float y):x(x),y(y){}
 
 	float2 operator-() const
 	{
@@ -67,17 +67,18 @@ public:
 		y *= a;
 	}
 
-	float norm()
+	float norm() const
 	{
 		return sqrtf(x*x+y*y);
 	}
 
-	float norm2()
+	float norm2() const
 	{
 		return x*x+y*y;
 	}
 
-	float2 normalize()
+	// normalizes in place
+	float2& normalize()
 	{
 		float oneOverLength = 1.0f / norm();
 		x *= oneOverLength;
@@ -85,6 +86,17 @@ public:
 		return *this;
 	}
 
+	// returns a unit length copy, leaving this vector untouched
+	float2 normalized() const
+	{
+		return *this * (1.0f / norm());
+	}
+
+	float dot(const float2& operand) const
+	{
+		return x * operand.x + y * operand.y;
+	}
+
 	static float2 random()
 	{
 		return float2(
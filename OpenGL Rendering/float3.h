@@ -3,28 +3,89 @@
 #include <math.h>
 #include <stdlib.h>
 
-class float3
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FLOAT3_SSE 1
+#endif
+
+// Three component vector padded to four floats so that it can be loaded
+// into a single SIMD register. The padding lane w is kept at zero.
+class alignas(16) float3
 {
 public:
 	float x;
 	float y;
 	float z;
+	float w;
 
 	float3()
 	{
 		x = ((float)rand() / RAND_MAX) * 2 - 1;
 		y = ((float)rand() / RAND_MAX) * 2 - 1;
 		z = ((float)rand() / RAND_MAX) * 2 - 1;
+		w = 0.0f;
 	}
 
-	float3(float x, float y, float z):x(x),y(y),z(z){}
+	constexpr float3(float x, float y, float z):x(x),y(y),z(z),w(0.0f){}
+
+#ifdef FLOAT3_SSE
+	explicit float3(__m128 v)
+	{
+		_mm_store_ps(&x, v);
+	}
+
+	__m128 simd() const
+	{
+		return _mm_load_ps(&x);
+	}
+#endif
 
 	float3 operator-() const
 	{
 		return float3(-x, -y, -z);
 	}
 
+#ifdef FLOAT3_SSE
+	float3 operator+(const float3& addOperand) const
+	{
+		return float3(_mm_add_ps(simd(), addOperand.simd()));
+	}
+
+	float3 operator-(const float3& operand) const
+	{
+		return float3(_mm_sub_ps(simd(), operand.simd()));
+	}
+
+	float3 operator*(const float3& operand) const
+	{
+		return float3(_mm_mul_ps(simd(), operand.simd()));
+	}
+
+	float3 operator*(float operand) const
+	{
+		return float3(_mm_mul_ps(simd(), _mm_set1_ps(operand)));
+	}
+
+	void operator-=(const float3& a)
+	{
+		_mm_store_ps(&x, _mm_sub_ps(simd(), a.simd()));
+	}
+
+	void operator+=(const float3& a)
+	{
+		_mm_store_ps(&x, _mm_add_ps(simd(), a.simd()));
+	}
+
+	void operator*=(const float3& a)
+	{
+		_mm_store_ps(&x, _mm_mul_ps(simd(), a.simd()));
+	}
 
+	void operator*=(float a)
+	{
+		_mm_store_ps(&x, _mm_mul_ps(simd(), _mm_set1_ps(a)));
+	}
+#else
 	float3 operator+(const float3& addOperand) const
 	{
 		return float3(x + addOperand.x, y + addOperand.y, z + addOperand.z);
@@ -39,7 +100,7 @@ public:
 	{
 		return float3(x * operand.x, y * operand.y, z * operand.z);
 	}
-	
+
 	float3 operator*(float operand) const
 	{
 		return float3(x * operand, y * operand, z * operand);
@@ -72,6 +133,7 @@ public:
 		y *= a;
 		z *= a;
 	}
+#endif
 
 	float norm() const
 	{
@@ -83,15 +145,19 @@ public:
 		return x*x+y*y+z*z;
 	}
 
-	float3 normalize()
+	// normalizes in place
+	float3& normalize()
 	{
-		float oneOverLength = 1.0f / norm();
-		x *= oneOverLength;
-		y *= oneOverLength;
-		z *= oneOverLength;
+		*this *= 1.0f / norm();
 		return *this;
 	}
-	
+
+	// returns a unit length copy, leaving this vector untouched
+	float3 normalized() const
+	{
+		return *this * (1.0f / norm());
+	}
+
 	float3 cross(const float3& operand) const
 	{
 		return float3(
@@ -106,4 +172,9 @@ public:
 		return x * operand.x + y * operand.y + z * operand.z;
 	}
 
+	static float3 lerp(const float3& a, const float3& b, float t)
+	{
+		return a + (b - a) * t;
+	}
+
 };
\ No newline at end of file
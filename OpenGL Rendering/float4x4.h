@@ -0,0 +1,262 @@
+#pragma once
+
+#include "float3.h"
+
+// 4x4 matrix stored in column-major order, so that it can be handed to
+// glLoadMatrixf / glMultMatrixf / glUniformMatrix4fv as is.
+// Element (row, col) lives at m[col*4 + row].
+class alignas(16) float4x4
+{
+public:
+	float m[16];
+
+	constexpr float4x4()
+		:m{1, 0, 0, 0,
+		   0, 1, 0, 0,
+		   0, 0, 1, 0,
+		   0, 0, 0, 1}{}
+
+	constexpr float4x4(
+		float m00, float m01, float m02, float m03,
+		float m10, float m11, float m12, float m13,
+		float m20, float m21, float m22, float m23,
+		float m30, float m31, float m32, float m33)
+		:m{m00, m10, m20, m30,
+		   m01, m11, m21, m31,
+		   m02, m12, m22, m32,
+		   m03, m13, m23, m33}{}
+
+	float& operator()(int row, int col)
+	{
+		return m[col*4 + row];
+	}
+
+	float operator()(int row, int col) const
+	{
+		return m[col*4 + row];
+	}
+
+	const float* data() const
+	{
+		return m;
+	}
+
+	static float4x4 identity()
+	{
+		return float4x4();
+	}
+
+	static float4x4 translation(const float3& offset)
+	{
+		return float4x4(
+			1, 0, 0, offset.x,
+			0, 1, 0, offset.y,
+			0, 0, 1, offset.z,
+			0, 0, 0, 1);
+	}
+
+	static float4x4 scaling(const float3& factor)
+	{
+		return float4x4(
+			factor.x, 0, 0, 0,
+			0, factor.y, 0, 0,
+			0, 0, factor.z, 0,
+			0, 0, 0, 1);
+	}
+
+	// same convention as glRotatef: angle in degrees, counter-clockwise about axis
+	static float4x4 rotation(float angle, const float3& axis)
+	{
+		float3 a = axis.normalized();
+		float rad = angle * (float)(M_PI / 180.0);
+		float c = cosf(rad);
+		float s = sinf(rad);
+		float t = 1 - c;
+		return float4x4(
+			t*a.x*a.x + c,     t*a.x*a.y - s*a.z, t*a.x*a.z + s*a.y, 0,
+			t*a.x*a.y + s*a.z, t*a.y*a.y + c,     t*a.y*a.z - s*a.x, 0,
+			t*a.x*a.z - s*a.y, t*a.y*a.z + s*a.x, t*a.z*a.z + c,     0,
+			0, 0, 0, 1);
+	}
+
+	// rotation about the y axis only, the common case for objects on the island
+	static float4x4 rotationY(float angle)
+	{
+		float rad = angle * (float)(M_PI / 180.0);
+		float c = cosf(rad);
+		float s = sinf(rad);
+		return float4x4(
+			c, 0, s, 0,
+			0, 1, 0, 0,
+			-s, 0, c, 0,
+			0, 0, 0, 1);
+	}
+
+	// same convention as gluPerspective, but fovy is in radians
+	static float4x4 perspective(float fovy, float aspect, float zNear, float zFar)
+	{
+		float f = 1.0f / tanf(fovy * 0.5f);
+		return float4x4(
+			f / aspect, 0, 0, 0,
+			0, f, 0, 0,
+			0, 0, (zFar + zNear) / (zNear - zFar), 2 * zFar * zNear / (zNear - zFar),
+			0, 0, -1, 0);
+	}
+
+	static float4x4 orthographic(float left, float right, float bottom, float top, float zNear, float zFar)
+	{
+		return float4x4(
+			2 / (right - left), 0, 0, -(right + left) / (right - left),
+			0, 2 / (top - bottom), 0, -(top + bottom) / (top - bottom),
+			0, 0, -2 / (zFar - zNear), -(zFar + zNear) / (zFar - zNear),
+			0, 0, 0, 1);
+	}
+
+	// same convention as gluLookAt
+	static float4x4 lookAt(const float3& eye, const float3& target, const float3& up)
+	{
+		float3 f = (target - eye).normalized();
+		float3 s = f.cross(up).normalized();
+		float3 u = s.cross(f);
+		return float4x4(
+			s.x, s.y, s.z, -s.dot(eye),
+			u.x, u.y, u.z, -u.dot(eye),
+			-f.x, -f.y, -f.z, f.dot(eye),
+			0, 0, 0, 1);
+	}
+
+	float4x4 operator*(const float4x4& operand) const
+	{
+		float4x4 result;
+#ifdef FLOAT3_SSE
+		__m128 c0 = _mm_load_ps(m);
+		__m128 c1 = _mm_load_ps(m + 4);
+		__m128 c2 = _mm_load_ps(m + 8);
+		__m128 c3 = _mm_load_ps(m + 12);
+		for(int col = 0; col < 4; col++)
+		{
+			const float* b = operand.m + col*4;
+			__m128 r = _mm_mul_ps(c0, _mm_set1_ps(b[0]));
+			r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(b[1])));
+			r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(b[2])));
+			r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(b[3])));
+			_mm_store_ps(result.m + col*4, r);
+		}
+#else
+		for(int col = 0; col < 4; col++)
+			for(int row = 0; row < 4; row++)
+				result.m[col*4 + row] =
+					m[row]      * operand.m[col*4] +
+					m[4 + row]  * operand.m[col*4 + 1] +
+					m[8 + row]  * operand.m[col*4 + 2] +
+					m[12 + row] * operand.m[col*4 + 3];
+#endif
+		return result;
+	}
+
+	void operator*=(const float4x4& operand)
+	{
+		*this = *this * operand;
+	}
+
+	float3 transformPoint(const float3& p) const
+	{
+#ifdef FLOAT3_SSE
+		__m128 r = _mm_mul_ps(_mm_load_ps(m), _mm_set1_ps(p.x));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m + 4), _mm_set1_ps(p.y)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m + 8), _mm_set1_ps(p.z)));
+		r = _mm_add_ps(r, _mm_load_ps(m + 12));
+		float3 result(r);
+		result.w = 0.0f;
+		return result;
+#else
+		return float3(
+			m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12],
+			m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13],
+			m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14]);
+#endif
+	}
+
+	float3 transformDirection(const float3& d) const
+	{
+		return float3(
+			m[0]*d.x + m[4]*d.y + m[8]*d.z,
+			m[1]*d.x + m[5]*d.y + m[9]*d.z,
+			m[2]*d.x + m[6]*d.y + m[10]*d.z);
+	}
+
+	// transforms a point and performs the perspective divide
+	float3 transformProjected(const float3& p) const
+	{
+		float invW = 1.0f / (m[3]*p.x + m[7]*p.y + m[11]*p.z + m[15]);
+		return transformPoint(p) * invW;
+	}
+
+	// transforms count points in one go; in and out may alias
+	void transformPoints(const float3* in, float3* out, size_t count) const
+	{
+#ifdef FLOAT3_SSE
+		__m128 c0 = _mm_load_ps(m);
+		__m128 c1 = _mm_load_ps(m + 4);
+		__m128 c2 = _mm_load_ps(m + 8);
+		__m128 c3 = _mm_load_ps(m + 12);
+		for(size_t i = 0; i < count; i++)
+		{
+			__m128 p = in[i].simd();
+			__m128 r = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0))));
+			r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))));
+			r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))));
+			_mm_store_ps(&out[i].x, r);
+			out[i].w = 0.0f;
+		}
+#else
+		for(size_t i = 0; i < count; i++)
+			out[i] = transformPoint(in[i]);
+#endif
+	}
+
+	float3 getTranslation() const
+	{
+		return float3(m[12], m[13], m[14]);
+	}
+
+	float4x4 transposed() const
+	{
+		return float4x4(
+			m[0], m[1], m[2], m[3],
+			m[4], m[5], m[6], m[7],
+			m[8], m[9], m[10], m[11],
+			m[12], m[13], m[14], m[15]);
+	}
+
+	// general inverse by cofactor expansion; returns identity for singular matrices
+	float4x4 inverse() const
+	{
+		float inv[16];
+		inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+		inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+		inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+		inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+		inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+		inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+		inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+		inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+		inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+		inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+		inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+		inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+		inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+		inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+		inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+		inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+		float det = m[0]*inv[0] + m[1]*inv[4] + m[2]*inv[8] + m[3]*inv[12];
+		float4x4 result;
+		if(det == 0)
+			return result;
+		float oneOverDet = 1.0f / det;
+		for(int i = 0; i < 16; i++)
+			result.m[i] = inv[i] * oneOverDet;
+		return result;
+	}
+};
@@ -9,6 +9,8 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
@@ -16,11 +18,35 @@
 
 #include "float2.h"
 #include "float3.h"
+#include "float4x4.h"
+#include "quaternion.h"
 #include "Mesh.h"
+#include "BVH.h"
+#include "Terrain.h"
+#include "Frustum.h"
+#include "ShadowMap.h"
+#include "Shader.h"
+#include "ForwardShading.h"
+#include "LightClusters.h"
+#include "GBuffer.h"
+#include "DeferredShading.h"
+#include "OcclusionQueries.h"
+#include "SoftwareOcclusion.h"
+#include "JobSystem.h"
+#include "TaskGraph.h"
+#include "Profiler.h"
+#include "FrameArena.h"
+#include "Pool.h"
+#include "Benchmarks.h"
+#include "Entities.h"
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <chrono>
+#include <random>
 
 extern "C" unsigned char* stbi_load(char const *filename, int *x, int *y, int *comp, int req_comp);
+extern "C" void stbi_image_free(void *retval_from_stbi_load);
 
 float START_ROT = 90;
 int NUM_TEAPOTS = 0;
@@ -35,6 +61,9 @@ public:
 	virtual float3 getLightDirAt  ( float3 x )=0;
 	virtual float  getDistanceFrom( float3 x )=0;
 	virtual void   apply( GLenum openglLightName )=0;
+	// for the shaders: position with w = 0 for directions, power, and the
+	// quadratic attenuation coefficient (0 for none)
+	virtual void   getShaderData( float position[4], float3& power, float& attenuation )=0;
 };
 
 class DirectionalLight : public LightSource
@@ -60,6 +89,12 @@ public:
         glLightf(openglLightName, GL_LINEAR_ATTENUATION, 0.0f);
         glLightf(openglLightName, GL_QUADRATIC_ATTENUATION, 0.0f);
 	}
+	void   getShaderData( float position[4], float3& power, float& attenuation )
+	{
+		position[0] = dir.x; position[1] = dir.y; position[2] = dir.z; position[3] = 0.0f;
+		power = powerDensity;
+		attenuation = 0.0f;
+	}
 };
 
 class PointLight : public LightSource
@@ -70,7 +105,7 @@ public:
 	PointLight(float3 pos, float3 power)
     :pos(pos), power(power){}
 	float3 getpowerDensityAt  ( float3 x ){return power*(1/(x-pos).norm2()*4*3.14);}
-	float3 getLightDirAt  ( float3 x ){return (pos-x).normalize();}
+	float3 getLightDirAt  ( float3 x ){return (pos-x).normalized();}
 	float  getDistanceFrom( float3 x ){return (pos-x).norm();}
 	void   apply( GLenum openglLightName )
 	{
@@ -85,6 +120,12 @@ public:
         glLightf(openglLightName, GL_LINEAR_ATTENUATION, 0.0f);
         glLightf(openglLightName, GL_QUADRATIC_ATTENUATION, 0.25f / 3.14f);
 	}
+	void   getShaderData( float position[4], float3& power, float& attenuation )
+	{
+		position[0] = pos.x; position[1] = pos.y; position[2] = pos.z; position[3] = 1.0f;
+		power = this->power;
+		attenuation = 0.25f / 3.14f;
+	}
 };
 
 class Material
@@ -101,6 +142,9 @@ public:
 	}
 	virtual void apply()
 	{
+		// a fifth of the diffuse reflectance, as the shaders' ambient()
+		float aglAmbient[] = {kd.x * 0.2f, kd.y * 0.2f, kd.z * 0.2f, 1.0f};
+		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, aglAmbient);
 		float aglDiffuse[] = {kd.x, kd.y, kd.z, 1.0f};
 		glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, aglDiffuse);
 		float aglSpecular[] = {kd.x, kd.y, kd.z, 1.0f};
@@ -109,103 +153,244 @@ public:
 			glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
 		else
 			glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 128.0f);
+		if(Shader* shader = Shader::getActive())
+			shader->set("uTextured", 0);
 	}
     virtual void bind(){};
 };
 
+// Pixels of an image file. Decoding needs no GL context, so it can happen
+// on any thread.
+struct ImageFile {
+    unsigned char* data;
+    int width;
+    int height;
+    int nComponents;
+    
+    ImageFile():data(NULL),width(0),height(0),nComponents(0){}
+    ~ImageFile() {
+        stbi_image_free(data);
+    }
+    // owns data
+    ImageFile(const ImageFile&) = delete;
+    ImageFile& operator=(const ImageFile&) = delete;
+    void load(const char* filename) {
+        PROFILE_ZONE("image decode");
+        data = stbi_load(filename, &width, &height, &nComponents, 0);
+    }
+};
+
 class TexturedMaterial : public Material {
     unsigned int textureName;
-public:
-    TexturedMaterial(const char* filename,
-                     GLint filtering = GL_LINEAR_MIPMAP_LINEAR
-                     ){
-        unsigned char* data;
-        int width;
-        int height;
-        int nComponents = 4;
-        
-        data = stbi_load(filename, &width, &height, &nComponents, 0);
-        
-        if(data == NULL) return;
+    
+    void upload(const ImageFile& image, GLint filtering) {
+        PROFILE_ZONE("TexturedMaterial");
+        if(image.data == NULL) return;
         
         // opengl texture creation below
         
         glGenTextures(1, &textureName);  // id generation
         glBindTexture(GL_TEXTURE_2D, textureName);      // binding
         
-        if(nComponents == 4)
-            gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        else if(nComponents == 3)
-            gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGB, width, height, GL_RGB, GL_UNSIGNED_BYTE, data);
-        
-        delete data;
+        if(image.nComponents == 4)
+            gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, image.data);
+        else if(image.nComponents == 3)
+            gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGB, image.width, image.height, GL_RGB, GL_UNSIGNED_BYTE, image.data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filtering);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+public:
+    TexturedMaterial(const char* filename,
+                     GLint filtering = GL_LINEAR_MIPMAP_LINEAR
+                     ){
+        ImageFile image;
+        image.load(filename);
+        upload(image, filtering);
+    }
+    // from an image decoded beforehand
+    TexturedMaterial(const ImageFile& image,
+                     GLint filtering = GL_LINEAR_MIPMAP_LINEAR
+                     ){
+        upload(image, filtering);
     }
     void apply() {
         Material::apply();
         glEnable(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, textureName);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        if(Shader* shader = Shader::getActive())
+            shader->set("uTextured", 1);
     }
 };
 
 // Object abstract base class.
+// Objects form a transform hierarchy: position, orientation and scale are
+// relative to the parent, and the world matrix is the parent's world matrix
+// times the local one. Scene still owns every object, through its flat lists
+// and its pools of teapots.
 class Object
 {
 protected:
 	Material* material;
 	float3 scaleFactor;
 	float3 orientationAxis;
-public:
     float orientationAngle;
     float3 position;
-	Object(Material* material):material(material),position(0, 0, 0),orientationAngle(0.0f),scaleFactor(1.0,1.0,1.0),orientationAxis(0.0,1.0,0.0){}
-    virtual ~Object(){}
+    
+    Object* parent;
+    std::vector<Object*> children;
+    
+    // cached model to world transformation, rebuilt lazily when worldDirty is set.
+    // A dirty object never has a clean descendant.
+    float4x4 worldMatrix;
+    bool worldDirty;
+    
+    void invalidateWorld() {
+        if(worldDirty) return;
+        worldDirty = true;
+        for(Object *c : children)
+            c->invalidateWorld();
+    }
+public:
+	Object(Material* material):material(material),position(0, 0, 0),orientationAngle(0.0f),scaleFactor(1.0,1.0,1.0),orientationAxis(0.0,1.0,0.0),parent(nullptr),worldDirty(true){}
+    virtual ~Object(){
+        for(Object *c : children)
+            c->parent = nullptr;
+        if(parent)
+            parent->children.erase(std::find(parent->children.begin(), parent->children.end(), this));
+    }
     Object* translate(float3 offset){
-        position += offset; return this;
+        position += offset; invalidateWorld(); return this;
     }
     Object* scale(float3 factor){
-        scaleFactor *= factor; return this;
+        scaleFactor *= factor; invalidateWorld(); return this;
     }
     Object* rotate(float angle){
-        orientationAngle += angle; return this; // degrees
+        orientationAngle += angle; invalidateWorld(); return this; // degrees
+    }
+    // position relative to the parent
+    const float3& getPosition() const {
+        return position;
+    }
+    void setPosition(const float3& p) {
+        if(p.x != position.x || p.y != position.y || p.z != position.z) {
+            position = p;
+            invalidateWorld();
+        }
+    }
+    float getOrientationAngle() const {
+        return orientationAngle;
+    }
+    void setOrientationAngle(float angle) {
+        if(angle != orientationAngle) {
+            orientationAngle = angle;
+            invalidateWorld();
+        }
+    }
+    float3 getWorldPosition() {
+        return getWorldMatrix().getTranslation();
+    }
+    Object* getParent() const {
+        return parent;
+    }
+    // Re-parents this object while keeping its current world placement.
+    // Scale and orientation are assumed to be about the shared y axis.
+    Object* attachTo(Object* newParent) {
+        float3 worldPos = getWorldPosition();
+        float worldAngle = orientationAngle;
+        float3 worldScale = scaleFactor;
+        for(Object *p = parent; p; p = p->parent) {
+            worldAngle += p->orientationAngle;
+            worldScale *= p->scaleFactor;
+        }
+        detach();
+        if(newParent) {
+            parent = newParent;
+            newParent->children.push_back(this);
+            position = newParent->getWorldMatrix().inverse().transformPoint(worldPos);
+            for(Object *p = newParent; p; p = p->parent) {
+                worldAngle -= p->orientationAngle;
+                worldScale = float3(worldScale.x / p->scaleFactor.x,
+                                    worldScale.y / p->scaleFactor.y,
+                                    worldScale.z / p->scaleFactor.z);
+            }
+        } else {
+            position = worldPos;
+        }
+        orientationAngle = worldAngle;
+        scaleFactor = worldScale;
+        invalidateWorld();
+        return this;
+    }
+    // Removes this object from its parent without keeping its world placement.
+    void detach() {
+        if(!parent) return;
+        parent->children.erase(std::find(parent->children.begin(), parent->children.end(), this));
+        parent = nullptr;
+        invalidateWorld();
+    }
+    // model to world transformation: scaling, then orientation, then translation,
+    // then the parent's world transformation
+    const float4x4& getWorldMatrix() {
+        if(worldDirty) {
+            worldMatrix = float4x4::translation(position)
+                * float4x4::rotation(orientationAngle, orientationAxis)
+                * float4x4::scaling(scaleFactor);
+            if(parent)
+                worldMatrix = parent->getWorldMatrix() * worldMatrix;
+            worldDirty = false;
+        }
+        return worldMatrix;
+    }
+    // Bounds of the model before the world transformation; empty when unknown.
+    virtual AABB getLocalBounds() {
+        return AABB();
+    }
+    AABB getWorldBounds() {
+        AABB local = getLocalBounds();
+        if(local.isEmpty())
+            return local;
+        return local.transformed(getWorldMatrix());
+    }
+    // Ray query in model space. With anyHit set, any hit before tMax will do.
+    virtual bool intersectModel(const float3&, const float3&, float, bool, float&) {
+        return false;
+    }
+    // Ray query in world space; since dir is transformed without normalizing,
+    // t means the same in both spaces.
+    bool intersect(const float3& origin, const float3& dir, float tMax, bool anyHit, float& t) {
+        float4x4 worldToModel = getWorldMatrix().inverse();
+        return intersectModel(worldToModel.transformPoint(origin),
+                              worldToModel.transformDirection(dir), tMax, anyHit, t);
     }
     virtual void draw()
     {
+        PROFILE_ZONE("Object::draw");
 		material->apply();
         // apply scaling, translation and orientation
 		glMatrixMode(GL_MODELVIEW);
 		glPushMatrix();
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(orientationAngle, orientationAxis.x, orientationAxis.y, orientationAxis.z);
-        glScalef(scaleFactor.x, scaleFactor.y, scaleFactor.z);
+        glMultMatrixf(getWorldMatrix().data());
         drawModel();
 		glPopMatrix();
     }
     virtual void drawModel()=0;
-    virtual void drawShadow(float3 lightDir) {
-        float shear[] = {
-            1, 0, 0, 0,
-            -lightDir.x, 1, -lightDir.z, 0,
-            0, 0, 1, 0,
-            0, 0, 0, 1 };
-        
-		glMatrixMode(GL_MODELVIEW);
+    // geometry only, for depth passes such as shadow maps
+    void drawDepth()
+    {
+        PROFILE_ZONE("Object::drawDepth");
 		glPushMatrix();
-    
-        glMultMatrixf(shear);
-        glTranslatef(0, 0.01, 0);
-        glScalef(1,0,1);
-        
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(orientationAngle, orientationAxis.x, orientationAxis.y, orientationAxis.z);
-        glScalef(scaleFactor.x, scaleFactor.y, scaleFactor.z);
+        glMultMatrixf(getWorldMatrix().data());
         drawModel();
 		glPopMatrix();
     }
-    virtual void move(double t, double dt){}
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects){return false;}
+    virtual bool castsShadow() {
+        return true;
+    }
+    // blends over what is behind it
+    virtual bool isTransparent() {
+        return false;
+    }
 };
 
 class Teapot : public Object
@@ -216,17 +401,70 @@ public:
 	{
 		glutSolidTeapot(1.0f);
 	}
+    AABB getLocalBounds() {
+        return AABB(float3(-1.5, -0.75, -1), float3(1.75, 0.9, 1));
+    }
 };
 
+typedef Pool<Teapot>::Handle TeapotHandle;
+
+// Flat textured ground, such as the sea, split into square tiles. The tiles
+// live in one vertex buffer; each frame the ones inside the view frustum are
+// gathered into a single draw call. Every tile repeats the texture a whole
+// number of times from 0, so texture coordinates stay small anywhere.
 class Ground : public Object {
     float3 start;
     float size;
+    float tileSize;
+    std::vector<AABB> tiles;
+    std::vector<GLuint> visibleIndices;    // four per tile that passed cull()
+    GLuint vertexBuffer;
 public:
-	Ground(Material* material, float3 startingLoc, float size)
-        :Object(material), start(startingLoc), size(size){}
+	Ground(Material* material, float3 startingLoc, float size, float tileSize = 50)
+        :Object(material), start(startingLoc), size(size), tileSize(tileSize){
+        const float texturePeriod = 50;
+        float texMax = floorf(tileSize / texturePeriod + 0.5f);
+        int tilesPerSide = (int)ceilf(2 * size / tileSize);
+        std::vector<float> vertices;
+        for(int j = 0; j < tilesPerSide; j++) {
+            for(int i = 0; i < tilesPerSide; i++) {
+                float x0 = start.x - size + i * tileSize;
+                float z0 = start.z - size + j * tileSize;
+                float x1 = x0 + tileSize;
+                float z1 = z0 + tileSize;
+                float quad[4][5] = {
+                    {x0, start.y, z0, 0, 0}, {x1, start.y, z0, texMax, 0},
+                    {x1, start.y, z1, texMax, texMax}, {x0, start.y, z1, 0, texMax} };
+                vertices.insert(vertices.end(), &quad[0][0], &quad[0][0] + 20);
+                tiles.push_back(AABB(float3(x0, start.y, z0), float3(x1, start.y, z1)));
+            }
+        }
+        glGenBuffers(1, &vertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        for(GLuint v = 0; v < tiles.size() * 4; v++)
+            visibleIndices.push_back(v);
+    }
+    ~Ground() {
+        glDeleteBuffers(1, &vertexBuffer);
+    }
+    // keeps the tiles inside frustum, given in model space, for the next draw
+    void cull(const Frustum& frustum) {
+        visibleIndices.clear();
+        for(GLuint t = 0; t < tiles.size(); t++) {
+            if(!frustum.intersects(tiles[t]))
+                continue;
+            for(GLuint k = 0; k < 4; k++)
+                visibleIndices.push_back(t * 4 + k);
+        }
+    }
+    size_t getVisibleTiles() const {
+        return visibleIndices.size() / 4;
+    }
 	void drawModel()
 	{
-        float scaleF = 50;
+        if(visibleIndices.empty()) return;
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         
@@ -236,27 +474,83 @@ public:
         glTexParameteri(GL_TEXTURE_2D,
                         GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D,
-                        GL_TEXTURE_MAG_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+                        GL_TEXTURE_MAG_FILTER,GL_LINEAR);
         glTexEnvi(GL_TEXTURE_ENV,
                   GL_TEXTURE_ENV_MODE, GL_REPLACE);
+        Shader* shader = Shader::getActive();
+        if(shader)
+            shader->set("uLit", 0);
         
-        glBegin(GL_QUADS);
-        glTexCoord2d((-size+start.x)/scaleF,(-size+start.z)/scaleF);
-        glVertex3d(-size+start.x,0+start.y,-size+start.z);
-        glTexCoord2d((size+start.x)/scaleF,(-size+start.z)/scaleF);
-        glVertex3d(size+start.x,0+start.y,-size+start.z);
-        glTexCoord2d((size+start.x)/scaleF,(size+start.z)/scaleF);
-        glVertex3d(size+start.x,0+start.y,size+start.z);
-        glTexCoord2d((-size+start.x)/scaleF,(size+start.z)/scaleF);
-        glVertex3d(-size+start.x,0+start.y,size+start.z);
-        glEnd();
+        const GLsizei stride = 5 * sizeof(float);
+        glNormal3f(0, 1, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, stride, (const char*)0);
+        glTexCoordPointer(2, GL_FLOAT, stride, (const char*)0 + 3 * sizeof(float));
+        glDrawElements(GL_QUADS, (GLsizei)visibleIndices.size(), GL_UNSIGNED_INT, &visibleIndices[0]);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        if(shader)
+            shader->set("uLit", 1);
         
         glDisable(GL_TEXTURE_2D);
         glDisable(GL_BLEND);
 
 	}
-    void drawShadow(float3 lightDir) {
-        position = {0,0,0};
+    bool castsShadow() {
+        return false;
+    }
+    bool isTransparent() {
+        return true;
+    }
+    AABB getLocalBounds() {
+        return AABB(float3(start.x - size, start.y, start.z - size),
+                    float3(start.x + size, start.y, start.z + size));
+    }
+    bool intersectModel(const float3& origin, const float3& dir, float tMax, bool, float& t) {
+        if(dir.y == 0)
+            return false;
+        float tPlane = (start.y - origin.y) / dir.y;
+        if(tPlane <= 0 || tPlane > tMax)
+            return false;
+        float3 p = origin + dir * tPlane;
+        if(fabsf(p.x - start.x) > size || fabsf(p.z - start.z) > size)
+            return false;
+        t = tPlane;
+        return true;
+    }
+};
+
+// Rolling dunes on the island that sink below the sea past its shore.
+float islandHeight(float x, float z) {
+    float dunes = 1.2f * (1 + sinf(x * 0.06f) * cosf(z * 0.045f))
+                + 0.4f * (1 + sinf((x + z) * 0.13f)) + 0.3f;
+    float d = fmaxf(fabsf(x), fabsf(z));
+    float shore = (d - 95) / 30;
+    shore = shore < 0 ? 0 : (shore > 1 ? 1 : shore);
+    shore = shore * shore * (3 - 2 * shore);
+    return dunes * (1 - shore) - 4 * shore;
+}
+
+class Island : public Object {
+    Terrain* terrain;
+public:
+    Island(Material* material, Terrain* terrain):Object(material),terrain(terrain){}
+    void drawModel()
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        terrain->draw();
+    }
+    bool castsShadow() {
+        return false;
+    }
+    AABB getLocalBounds() {
+        return terrain->getBounds();
+    }
+    bool intersectModel(const float3& origin, const float3& dir, float tMax, bool, float& t) {
+        return terrain->intersect(origin, dir, tMax, t);
     }
 };
 
@@ -273,113 +567,25 @@ public:
 	{
 		mesh->draw();
 	}
-};
-
-class Balloon : public MeshInstance
-{
-    float3 acceleration;
-    float angularVelocity;
-    float angularAccel;
-    float restitution;
-public:
-    float3 velocity;
-
-    Balloon(Mesh* mesh, Material* material)
-    :MeshInstance(mesh, material), velocity(float3{0,0,0}) {}
-    
-    void move(double t, double dt) {
-        position = position + velocity*dt;
-    }
-};
-
-class Avatar : public MeshInstance {
-    float3 acceleration;
-    float angularVelocity;
-    float angularAccel;
-    float restitution;
-public:
-    float3 velocity;
-
-    Avatar(float rest, Mesh* mesh, Material* material)
-    :MeshInstance(mesh, material), velocity(float3{0,0,0}) {
-        //this->velocity = vel;
-        //this->angularVelocity = angVel;
-        this->restitution = rest;
-    }
-    void move(double t, double dt) {
-        float3 projPos = position + velocity*dt;
-        if(position.x > 99) {
-            if(projPos.x <= position.x) {
-                position = projPos;
-                velocity = velocity + acceleration*dt;
-            } else {
-                velocity = float3(0,0,0);
-            }
-        } else if(position.x < -99) {
-            if(projPos.x >= position.x) {
-                position = projPos;
-                velocity = velocity + acceleration*dt;
-            } else {
-                velocity = float3(0,0,0);
-            }
-        } else if(position.z > 99) {
-            if(projPos.z <= position.z) {
-                position = projPos;
-                velocity = velocity + acceleration*dt;
-            } else {
-                velocity = float3(0,0,0);
-            }
-        } else if(position.z < -99) {
-            if(projPos.z >= position.z) {
-                position = projPos;
-                velocity = velocity + acceleration*dt;
-            } else {
-                velocity = float3(0,0,0);
-            }
-        } else {
-            velocity = velocity + acceleration*dt;
-            position = position + velocity*dt;
-        }
-        if(position.y < 0) {
-            velocity.y *= -restitution;
-            position.y = 0;
-        }
-        
-        velocity *= pow(0.8, dt);
-        
-        angularVelocity = angularVelocity + angularAccel*dt;
-        orientationAngle = orientationAngle + angularVelocity*dt;
-        angularVelocity *= pow(0.8, dt);
-
-    }
-    virtual Object* rotate(float angle){
-        orientationAngle += angle; return this; // degrees
+    AABB getLocalBounds() {
+        return mesh->getBounds();
     }
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn,
-                         std::vector<Object*>& objects){
-        if(keysPressed['a'] == true) {
-            angularAccel = 100;
-        } else if (keysPressed['d'] == true) {
-            angularAccel = -100;
-        } else {
-            angularAccel = 0;
-        }
-        // convert orientationAngle to radians from degrees
-        float tempOrientationAngle = orientationAngle * (M_PI/180);
-
-        if(keysPressed['w']) {
-            acceleration = float3((-cos(tempOrientationAngle)*10), -10, (sin(tempOrientationAngle) *10));
-        } else if (keysPressed['s']) {
-            acceleration = float3((cos(tempOrientationAngle) *10), -10, (-sin(tempOrientationAngle) *10));
-        } else {
-            acceleration = {0,-10,0};
+    bool intersectModel(const float3& origin, const float3& dir, float tMax, bool anyHit, float& t) {
+        const BVH& bvh = mesh->getBVH();
+        if(anyHit) {
+            t = tMax;
+            return bvh.occluded(origin, dir, tMax);
         }
-        return false;
+        BVH::Hit hit;
+        if(!bvh.intersect(origin, dir, tMax, hit))
+            return false;
+        t = hit.t;
+        return true;
     }
 };
 
-Avatar *player = nullptr;
-Balloon* balloon;
+Object *player = nullptr;
+Object* balloon;
 
 // Skeletal Camera class. Feel free to add custom initialization, set aspect ratio to fit viewport dimensions, or animation.
 class Camera
@@ -394,6 +600,11 @@ class Camera
     
 	float fov;
 	float aspect;
+    float nearPlane;
+    float farPlane;
+    
+    float4x4 viewMatrix;
+    float4x4 projMatrix;
 public:
     float3 eye;
     float3 ahead;
@@ -411,18 +622,39 @@ public:
 		up = float3(0, 1, 0);
 		fov = 1.5;
 		aspect = 1;
+        nearPlane = 0.1;
+        farPlane = 200;
 	}
     
 	void apply()
 	{
+        projMatrix = float4x4::perspective(fov, aspect, nearPlane, farPlane);
+        viewMatrix = float4x4::lookAt(eye, lookAt, float3(0, 1, 0));
 		glMatrixMode(GL_PROJECTION);
-		glLoadIdentity();
-		gluPerspective(fov / 3.14 * 180, aspect, 0.1, 200);
+		glLoadMatrixf(projMatrix.data());
 		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
-		gluLookAt(eye.x, eye.y, eye.z, lookAt.x, lookAt.y, lookAt.z, 0.0, 1.0, 0.0);
+		glLoadMatrixf(viewMatrix.data());
 	}
     
+    float getFov() const {
+        return fov;
+    }
+    float getAspect() const {
+        return aspect;
+    }
+    float getNearPlane() const {
+        return nearPlane;
+    }
+    float getFarPlane() const {
+        return farPlane;
+    }
+    const float4x4& getViewMatrix() const {
+        return viewMatrix;
+    }
+    const float4x4& getProjMatrix() const {
+        return projMatrix;
+    }
+    
     void startDrag(int x, int y) {
         lastMousePos = float2(x, y);
     }
@@ -453,7 +685,7 @@ public:
         
         ahead = float3(sin(yaw)*cos(pitch), -sin(pitch),
                        cos(yaw)*cos(pitch) );
-        right = ahead.cross(float3(0, 1, 0)).normalize();
+        right = ahead.cross(float3(0, 1, 0)).normalized();
         up = right.cross(ahead);
         lookAt = eye + ahead;
     }
@@ -461,29 +693,165 @@ public:
     void setAspectRatio(float ar)  {
         aspect = ar;
     }
+    
+    // corners of the part of the view between distances nearDist and farDist,
+    // near ones first
+    void getFrustumCorners(float nearDist, float farDist, float3 corners[8]) const {
+        float3 f = ahead.normalized();
+        float3 r = f.cross(float3(0, 1, 0)).normalized();
+        float3 u = r.cross(f);
+        float tanY = tanf(fov * 0.5f);
+        float tanX = tanY * aspect;
+        float dists[2] = {nearDist, farDist};
+        for(int k = 0; k < 2; k++) {
+            float3 c = eye + f * dists[k];
+            float3 dx = r * (tanX * dists[k]);
+            float3 dy = u * (tanY * dists[k]);
+            corners[k*4 + 0] = c - dx - dy;
+            corners[k*4 + 1] = c + dx - dy;
+            corners[k*4 + 2] = c + dx + dy;
+            corners[k*4 + 3] = c - dx + dy;
+        }
+    }
+    
+    // ray from the eye through window pixel (x, y), reaching the far plane at t = 1
+    void getPickRay(int x, int y, float3& origin, float3& dir) const {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        float ndcX = 2.0f * (x - viewport[0]) / viewport[2] - 1.0f;
+        float ndcY = 1.0f - 2.0f * (y - viewport[1]) / viewport[3];
+        float4x4 clipToWorld = (projMatrix * viewMatrix).inverse();
+        origin = clipToWorld.transformProjected(float3(ndcX, ndcY, -1));
+        dir = clipToWorld.transformProjected(float3(ndcX, ndcY, 1)) - origin;
+    }
 };
 
 class Scene
 {
+    // every core's share of the frame: binning, culling, simulation
+    JobSystem* jobs;
+    
 	Camera camera;
 	std::vector<LightSource*> lightSources;
 	std::vector<Material*> materials;
     std::vector<Mesh*> meshes;
+    Terrain* terrain;
+    Object* island;
+    Ground* sea;
+    
+    // the strongest directional light casts shadows
+    LightSource* sun;
+    ShadowCascades* shadows;
+    // the cascades' texture units, one each, for the shaders
+    static const unsigned int SHADOW_UNIT = 10;
+    
+    // per-pixel lighting; without GLSL the fixed-function lights are used
+    Shader* forward;
+    bool lightsDirty;
+    
+    // lanterns drifting over the island, far more point lights than the
+    // shader's uniform arrays hold, so they are culled per froxel
+    struct Lantern {
+        float3 center;
+        float orbit;
+        float speed;
+        float phase;
+    };
+    std::vector<Lantern> lanterns;
+    std::vector<ClusteredLight> lanternLights;
+    bool lanternsOn;
+    LightClusters* clusters;
+    
+    // Deferred shading fills the G-buffer with gbufferShader, then lights
+    // each pixel once with deferred. Without them only forward is available.
+    Shader* gbufferShader;
+    Shader* deferred;
+    GBuffer* gbuffer;
+    bool deferredOn;
+    
+    // Opaque objects may lay down depth before they are shaded, and be
+    // skipped while their boxes were hidden last frame.
+    bool depthPrepass;
+    bool occlusionCulling;
+    OcclusionQueries* occlusion;
+    // the CPU alternative: terrain and tree trunks hide what is behind them
+    bool softwareCulling;
+    SoftwareOcclusion* softwareOcclusion;
+    
+    // What the frame draws, recorded by culling jobs before the GL thread
+    // replays it: one command per object in view, with its box.
+    struct DrawCommand {
+        Object* object;
+        AABB bounds;
+        bool nearEye;   // clipped boxes around the eye are never culled
+    };
+    std::vector<Object*> drawables;
+    std::vector<DrawCommand> drawCommands;
+    std::vector<unsigned char> inView;
+    std::vector<const DrawCommand*> renderList;
+    std::vector<const DrawCommand*> visibleObjects;
+    std::vector<const DrawCommand*> hiddenObjects;
+    
+    // One simulation step as tasks: the bodies must all have moved before
+    // collisions are looked for. Steps run as a job alongside drawing, so
+    // they only touch the entity world, never the drawn objects.
+    TaskGraph* stepGraph;
+    double stepDt;
+    JobSystem::Counter simulating;
+    int tracedFrames;
+    
+    // simulation state; objects only draw what the systems computed
+    EntityWorld entities;
+    SpatialHash collectibleGrid;
+    Entity playerEntity;
+    Entity balloonEntity;
+    
+    // scratch lists reused by every collision step
+    std::vector<SweepAndPrune::Pair> collisionPairs;
+    std::vector<Entity> sweepCandidates;
+    CollisionStats collisionStats;
+    // as of the steps last drawn, for reading while the next ones run
+    CollisionStats drawnCollisionStats;
+    // of the last frame
+    unsigned int terrainTriangles;
+    
+    // highlighted by a right click
+    Object* picked;
 public:
     std::vector<Object*> objects;
-    std::vector<Object*> teapots;
+    // the collectibles, the objects that come and go as the game runs
+    Pool<Teapot> teapots;
+    // the bouncing bodies of the stress scene
+    Pool<Teapot> stressTeapots;
 
-	Scene()
+	Scene():jobs(nullptr),terrain(nullptr),island(nullptr),sea(nullptr),sun(nullptr),shadows(nullptr),forward(nullptr),lightsDirty(true),
+        lanternsOn(false),clusters(nullptr),
+        gbufferShader(nullptr),deferred(nullptr),gbuffer(nullptr),deferredOn(false),
+        depthPrepass(false),occlusionCulling(false),occlusion(nullptr),
+        softwareCulling(false),softwareOcclusion(nullptr),
+        stepGraph(nullptr),stepDt(0),tracedFrames(0),collectibleGrid(10),terrainTriangles(0),picked(nullptr)
 	{
-		lightSources.push_back(new DirectionalLight(float3(10, 1, 0),
+		lightSources.push_back(new DirectionalLight(float3(10, 8, 3),
                                                     float3(1, 0.5, 1)));
         lightSources.push_back(new DirectionalLight(float3(-10, 1, 0),
                                                     float3(1, 0.5, 1)));
 		lightSources.push_back(new PointLight(float3(-1, -1, 1),
                                               float3(0.2, 0.1, 0.1)));
+        float strongest = 0;
+        for(LightSource *l : lightSources) {
+            if(!dynamic_cast<DirectionalLight*>(l)) continue;
+            float power = l->getpowerDensityAt(float3(0, 0, 0)).norm();
+            if(power > strongest) {
+                strongest = power;
+                sun = l;
+            }
+        }
 	}
 	~Scene()
 	{
+        // jobs still running use the world and the occluders
+        finishSimulation();
+        softwareOcclusion->wait();
 		for (std::vector<LightSource*>::iterator iLightSource = lightSources.begin(); iLightSource != lightSources.end(); ++iLightSource)
 			delete *iLightSource;
 		for (std::vector<Material*>::iterator iMaterial = materials.begin(); iMaterial != materials.end(); ++iMaterial)
@@ -492,8 +860,17 @@ public:
 			delete *iObject;
         for (std::vector<Mesh*>::iterator iMesh = meshes.begin(); iMesh != meshes.end(); ++iMesh)
 			delete *iMesh;
-        for (std::vector<Object*>::iterator iTeapot = teapots.begin(); iTeapot != teapots.end(); ++iTeapot)
-			delete *iTeapot;
+        delete terrain;
+        delete shadows;
+        delete forward;
+        delete clusters;
+        delete gbufferShader;
+        delete deferred;
+        delete gbuffer;
+        delete occlusion;
+        delete softwareOcclusion;
+        delete stepGraph;
+        delete jobs;
 	}
     
 public:
@@ -502,50 +879,439 @@ public:
 		return camera;
 	}
     
+    // Renders, depth only, the shadow casters the sun sees around each slice
+    // of the view into that slice's cascade.
+    void drawShadowMaps() {
+        const float casterReach = 60;
+        if(!sun) return;
+        float3 toLight = sun->getLightDirAt(float3(0, 0, 0));
+        shadows->computeSplits(camera.getNearPlane(), camera.getFarPlane());
+        for(int c = 0; c < shadows->getCount(); c++) {
+            ShadowCascades::Stats& stats = shadows->getStats(c);
+            stats.nearDist = shadows->getSplit(c);
+            stats.farDist = shadows->getSplit(c + 1);
+            stats.reused = !shadows->needsUpdate(c);
+            if(stats.reused) continue;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            
+            ShadowMap& map = shadows->getMap(c);
+            float3 corners[8];
+            camera.getFrustumCorners(stats.nearDist, stats.farDist, corners);
+            map.fit(corners, 8, toLight, casterReach);
+            Frustum lightFrustum = map.getFrustum();
+            stats.casters = 0;
+            map.begin();
+            for(Object *o : objects) {
+                if(!o->castsShadow() || !lightFrustum.intersects(o->getWorldBounds())) continue;
+                o->drawDepth();
+                stats.casters++;
+            }
+            for(const Pool<Teapot>* pool : {&teapots, &stressTeapots})
+                for(Object *t : *pool) {
+                    if(!lightFrustum.intersects(t->getWorldBounds())) continue;
+                    t->drawDepth();
+                    stats.casters++;
+                }
+            map.end();
+            
+            stats.milliseconds = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        shadows->nextFrame();
+    }
+    
+    // hands the lights to a lighting shader, which keeps them until they change
+    void uploadLights(Shader* shader) {
+        int count = (int)lightSources.size();
+        if(count > MAX_SHADER_LIGHTS)
+            count = MAX_SHADER_LIGHTS;
+        float positions[MAX_SHADER_LIGHTS * 4];
+        float powers[MAX_SHADER_LIGHTS * 3];
+        float attenuations[MAX_SHADER_LIGHTS];
+        int shadowed = -1;
+        for(int i = 0; i < count; i++) {
+            float3 power;
+            lightSources[i]->getShaderData(&positions[i * 4], power, attenuations[i]);
+            powers[i * 3] = power.x; powers[i * 3 + 1] = power.y; powers[i * 3 + 2] = power.z;
+            if(lightSources[i] == sun)
+                shadowed = i;
+        }
+        shader->set("uLightCount", count);
+        if(count > 0) {
+            shader->setArray4("uLightPosition", positions, count);
+            shader->setArray3("uLightPower", powers, count);
+            shader->setArray1("uLightAttenuation", attenuations, count);
+        }
+        shader->set("uShadowedLight", shadowed);
+    }
+    
+    // where the lanterns' froxels are, for the shader in use
+    void setClusterUniforms(Shader* shader) {
+        shader->set("uClustered", lanternsOn ? 1 : 0);
+        if(!lanternsOn) return;
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        float tileSize[2] = {(float)viewport[2] / LightClusters::TILES_X,
+                             (float)viewport[3] / LightClusters::TILES_Y};
+        glUniform2fv(shader->uniform("uTileSize"), 1, tileSize);
+        shader->set("uClusterNear", camera.getNearPlane());
+        shader->set("uSliceScale", LightClusters::SLICES / logf(camera.getFarPlane() / camera.getNearPlane()));
+    }
+    
+    // Lights every pixel the geometry pass left in the G-buffer.
+    void drawDeferredLighting() {
+        deferred->use();
+        deferred->set("uViewInverse", camera.getViewMatrix().inverse());
+        deferred->set("uView", camera.getViewMatrix());
+        deferred->set("uViewProjInverse", (camera.getProjMatrix() * camera.getViewMatrix()).inverse());
+        float screenSize[2] = {(float)gbuffer->getWidth(), (float)gbuffer->getHeight()};
+        glUniform2fv(deferred->uniform("uScreenSize"), 1, screenSize);
+        setClusterUniforms(deferred);
+        gbuffer->bind(5);
+        // the quad passes on the G-buffer's depths, for what is drawn after it
+        glDepthFunc(GL_ALWAYS);
+        glBegin(GL_QUADS);
+        glVertex2f(-1, -1);
+        glVertex2f(1, -1);
+        glVertex2f(1, 1);
+        glVertex2f(-1, 1);
+        glEnd();
+        glDepthFunc(GL_LESS);
+        gbuffer->unbind(5);
+    }
+    
+    const ShadowCascades& getShadows() const {
+        return *shadows;
+    }
+    
+    const CollisionStats& getCollisionStats() const {
+        return drawnCollisionStats;
+    }
+    
+    unsigned int getTerrainTriangles() const {
+        return terrainTriangles;
+    }
+    
+    enum SurfacePass { ALL_SURFACES, OPAQUE_SURFACES, TRANSPARENT_SURFACES };
+    
+    bool inPass(Object* o, SurfacePass pass) {
+        return pass == ALL_SURFACES || o->isTransparent() == (pass == TRANSPARENT_SURFACES);
+    }
+    
+    // Opaque objects that were not hidden last frame, depth only.
+    // Fixed-function transformation gives the same depths as the shaders.
+    void drawDepthPrepass() {
+        Shader* active = Shader::getActive();
+        Shader::useFixedFunction();
+        glPushAttrib(GL_COLOR_BUFFER_BIT | GL_ENABLE_BIT);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDisable(GL_LIGHTING);
+        glDisable(GL_TEXTURE_2D);
+        glDisable(GL_BLEND);
+        for(const DrawCommand* d : visibleObjects)
+            d->object->drawDepth();
+        glPopAttrib();
+        if(active)
+            active->use();
+    }
+    
+    // Records, as jobs, what the frame draws: each object's box is frustum
+    // tested and, if software culling is on, tested against the CPU depth
+    // buffer. Needs the camera applied.
+    void buildRenderList() {
+        drawables.assign(objects.begin(), objects.end());
+        drawables.insert(drawables.end(), teapots.begin(), teapots.end());
+        drawables.insert(drawables.end(), stressTeapots.begin(), stressTeapots.end());
+        // world matrices are cached on first use, which must not race
+        for(Object *o : drawables)
+            o->getWorldMatrix();
+        
+        Frustum frustum = Frustum::fromMatrix(camera.getProjMatrix() * camera.getViewMatrix());
+        // boxes around the eye get clipped, so those are always drawn
+        float3 eye = camera.getEye();
+        float nearReach = 2 * camera.getNearPlane();
+        drawCommands.resize(drawables.size());
+        inView.resize(drawables.size());
+        jobs->parallelFor((int)drawables.size(), 32, [&](int begin, int end) {
+            for(int i = begin; i < end; i++) {
+                DrawCommand& d = drawCommands[i];
+                d.object = drawables[i];
+                d.bounds = d.object->getWorldBounds();
+                d.nearEye = d.bounds.expanded(nearReach).contains(eye);
+                bool seen = frustum.intersects(d.bounds);
+                // see-through surfaces do not hide what is behind them
+                if(seen && softwareCulling && !d.nearEye && !d.object->isTransparent() &&
+                   softwareOcclusion->isOccluded(d.bounds))
+                    seen = false;
+                inView[i] = seen;
+            }
+        }, "cull");
+        renderList.clear();
+        for(size_t i = 0; i < drawCommands.size(); i++)
+            if(inView[i])
+                renderList.push_back(&drawCommands[i]);
+    }
+    
+    // The surfaces of one pass, with the camera's projection. The sun's
+    // shadow cascades must be bound where the shaders look them up.
+    void drawSurfaces(SurfacePass pass) {
+        bool cull = occlusionCulling && pass != TRANSPARENT_SURFACES;
+        // cull in each ground's model space
+        float4x4 viewProj = camera.getProjMatrix() * camera.getViewMatrix();
+        // the terrain's level of detail, in the passes that draw the island
+        if(inPass(island, pass)) {
+            float3 islandEye = island->getWorldMatrix().inverse().transformPoint(camera.getEye());
+            terrain->selectLod(islandEye, Frustum::fromMatrix(viewProj * island->getWorldMatrix()));
+            terrainTriangles = terrain->getTrianglesDrawn();
+        }
+        sea->cull(Frustum::fromMatrix(viewProj * sea->getWorldMatrix()));
+        
+        visibleObjects.clear();
+        hiddenObjects.clear();
+        for(const DrawCommand* d : renderList) {
+            if(!inPass(d->object, pass)) continue;
+            if(cull && !d->nearEye && !occlusion->isVisible(d->object))
+                hiddenObjects.push_back(d);
+            else
+                visibleObjects.push_back(d);
+        }
+        
+        bool prepass = depthPrepass && pass != TRANSPARENT_SURFACES;
+        if(prepass) {
+            drawDepthPrepass();
+            glDepthFunc(GL_LEQUAL);
+        }
+        for(const DrawCommand* d : visibleObjects)
+            d->object->draw();
+        if(prepass)
+            glDepthFunc(GL_LESS);
+        
+        // hidden objects are tested again, to find out when they reappear
+        if(cull) {
+            occlusion->beginQueries();
+            for(int list = 0; list < 2; list++)
+                for(const DrawCommand* d : list ? hiddenObjects : visibleObjects)
+                    if(!d->nearEye)
+                        occlusion->query(d->object, d->bounds);
+            occlusion->endQueries();
+        }
+    }
+    
+    // The cascades' matrices and where each ends along the view, for the
+    // shaders' SHADOW_FUNCTIONS.
+    void setShadowUniforms(Shader* shader) {
+        int cascades = shadows->getCount();
+        float4x4 matrices[ShadowCascades::MAX_CASCADES];
+        float ends[ShadowCascades::MAX_CASCADES];
+        for(int c = 0; c < cascades; c++) {
+            matrices[c] = shadows->getMap(c).getShadowMatrix();
+            ends[c] = shadows->getSplit(c + 1);
+        }
+        shader->set("uCascadeCount", cascades);
+        shader->setArray1("uCascadeEnds", ends, cascades);
+        shader->setArray4x4("uShadowMatrices", matrices, cascades);
+    }
+    
 	void draw()
 	{
+        PROFILE_ZONE("Scene::draw");
+        if(occlusionCulling)
+            occlusion->beginFrame();
+        softwareOcclusion->wait();
+        {
+            PROFILE_GPU("shadow maps");
+            drawShadowMaps();
+        }
 		camera.apply();
-		unsigned int iLightSource=0;
-        float3 lightDir = float3(0,0,0);
-		for (; iLightSource<lightSources.size(); iLightSource++)
-		{
-			glEnable(GL_LIGHT0 + iLightSource);
-			lightSources.at(iLightSource)->apply(GL_LIGHT0 + iLightSource);
-            lightDir = lightDir + lightSources.at(iLightSource)->getLightDirAt(float3(0, 0, 0));
-
-		}
-		for (; iLightSource<GL_MAX_LIGHTS; iLightSource++)
-			glDisable(GL_LIGHT0 + iLightSource);
-        
-        for (unsigned int iObject=0; iObject<objects.size(); iObject++)
-			objects.at(iObject)->draw();
-        for (unsigned int iTeapot=0; iTeapot<teapots.size(); iTeapot++)
-			teapots.at(iTeapot)->draw();
+        buildRenderList();
+        // a G-buffer the driver cannot render into at this size falls back to forward
+        bool deferredFrame = deferredOn && gbuffer->fitViewport();
+        if(forward) {
+            if(lightsDirty) {
+                Shader* lighting[] = {forward, deferred};
+                for(Shader* shader : lighting) {
+                    if(!shader) continue;
+                    shader->use();
+                    uploadLights(shader);
+                }
+                lightsDirty = false;
+            }
+            if(lanternsOn) {
+                clusters->build(lanternLights, camera.getViewMatrix(), camera.getFov(), camera.getAspect(),
+                                camera.getNearPlane(), camera.getFarPlane());
+                clusters->bind(2);
+            }
+            shadows->bind(SHADOW_UNIT);
+            if(deferredFrame) {
+                // the transparent pass after it shades forward
+                forward->use();
+                setShadowUniforms(forward);
+            }
+            Shader* geometry = deferredFrame ? gbufferShader : forward;
+            geometry->use();
+            geometry->set("uViewInverse", camera.getViewMatrix().inverse());
+            setShadowUniforms(geometry);
+            if(deferredFrame)
+                gbuffer->begin();
+            else
+                setClusterUniforms(forward);
+        } else {
+            unsigned int iLightSource=0;
+            for (; iLightSource<lightSources.size() && iLightSource<GL_MAX_LIGHTS; iLightSource++)
+            {
+                glEnable(GL_LIGHT0 + iLightSource);
+                lightSources.at(iLightSource)->apply(GL_LIGHT0 + iLightSource);
+            }
+            for (; iLightSource<GL_MAX_LIGHTS; iLightSource++)
+                glDisable(GL_LIGHT0 + iLightSource);
+            // fixed-function texturing reaches one map: the nearest cascade
+            shadows->getMap(0).bind(1);
+        }
+        
+        if(deferredFrame) {
+            {
+                PROFILE_GPU("G-buffer");
+                drawSurfaces(OPAQUE_SURFACES);
+                gbuffer->end();
+            }
+            {
+                PROFILE_GPU("deferred lighting");
+                drawDeferredLighting();
+            }
+            // the G-buffer holds one surface per pixel, so see-through ones
+            // are shaded forward on top
+            PROFILE_GPU("transparent");
+            forward->use();
+            setClusterUniforms(forward);
+            drawSurfaces(TRANSPARENT_SURFACES);
+        } else {
+            PROFILE_GPU("forward");
+            drawSurfaces(ALL_SURFACES);
+        }
+        if(forward) {
+            if(lanternsOn)
+                clusters->unbind(2);
+            shadows->unbind(SHADOW_UNIT);
+            Shader::useFixedFunction();
+        } else
+            shadows->getMap(0).unbind(1);
         
         glDisable(GL_TEXTURE_2D);
         glDisable(GL_LIGHTING);
 
-        glColor3d(0,0,0);
-        for(Object *o : objects) {
-            
-            o->drawShadow(lightDir);
-        }
-        for(Object *t : teapots) {
-            
-            t->drawShadow(lightDir);
-        }
+        if(picked)
+            drawBox(picked->getWorldBounds());
         
         glEnable(GL_TEXTURE_2D);
         glEnable(GL_LIGHTING);
         
 	}
     
+    // wireframe box, for highlighting
+    void drawBox(const AABB& box) {
+        if(box.isEmpty()) return;
+        const float3& a = box.min;
+        const float3& b = box.max;
+        float3 corners[8] = {
+            float3(a.x,a.y,a.z), float3(b.x,a.y,a.z), float3(b.x,a.y,b.z), float3(a.x,a.y,b.z),
+            float3(a.x,b.y,a.z), float3(b.x,b.y,a.z), float3(b.x,b.y,b.z), float3(a.x,b.y,b.z) };
+        static const int edges[24] = {
+            0,1, 1,2, 2,3, 3,0, 4,5, 5,6, 6,7, 7,4, 0,4, 1,5, 2,6, 3,7 };
+        glColor3d(1,1,0);
+        glBegin(GL_LINES);
+        for(int i = 0; i < 24; i++)
+            glVertex3f(corners[edges[i]].x, corners[edges[i]].y, corners[edges[i]].z);
+        glEnd();
+    }
+    
+    // Closest object along origin + t*dir, t in (0, tMax], tested against
+    // the actual triangles of meshes.
+    Object* raycast(const float3& origin, const float3& dir, float tMax, float& t) {
+        Object* closest = nullptr;
+        t = tMax;
+        for(Object *o : objects) {
+            float tHit;
+            if(o->intersect(origin, dir, t, false, tHit)) {
+                t = tHit;
+                closest = o;
+            }
+        }
+        for(const Pool<Teapot>* pool : {&teapots, &stressTeapots})
+            for(Object *o : *pool) {
+                float tHit;
+                if(o->intersect(origin, dir, t, false, tHit)) {
+                    t = tHit;
+                    closest = o;
+                }
+            }
+        return closest;
+    }
+    
+    bool lineOfSight(const float3& from, const float3& to) {
+        float t;
+        for(Object *o : objects)
+            if(o->intersect(from, to - from, 1, true, t))
+                return false;
+        return true;
+    }
+    
+    // height of the topmost surface below (x, maxHeight, z), or 0 if there is none
+    float groundHeight(float x, float z, float maxHeight = 100) {
+        float t;
+        if(!raycast(float3(x, maxHeight, z), float3(0, -1, 0), 2 * maxHeight, t))
+            return 0;
+        return maxHeight - t;
+    }
+    
+    // a collectible, before it is put on the island
+    void addTeapot(Material* material, const float3& position) {
+        teapots.get(teapots.create(material))->translate(position)->scale(float3(1.5, 1.5, 1.5));
+    }
+    
+    void pick(int x, int y) {
+        float3 origin, dir;
+        camera.getPickRay(x, y, origin, dir);
+        float t;
+        picked = raycast(origin, dir, 1, t);
+    }
+    
     void initialize() {
+        jobs = new JobSystem();
+        buildStepGraph();
         
-        TexturedMaterial* balloonSkin = new TexturedMaterial("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/balloon.png", GL_LINEAR);
+        // The files are read and decoded as tasks, and the meshes' ray
+        // query trees built; the GL objects are made from them below, on
+        // this thread, which owns the context.
+        ImageFile balloonImage, sandImage, waterImage, tiggerImage, barkImage;
+        Mesh* balloonMesh = nullptr;
+        Mesh* tigger = nullptr;
+        Mesh* treeMesh = nullptr;
+        {
+            TaskGraph loading(*jobs);
+            loading.add("balloon.png", [&]() { balloonImage.load("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/balloon.png"); });
+            loading.add("sand.jpg", [&]() { sandImage.load("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/sand.jpg"); });
+            loading.add("water.jpg", [&]() { waterImage.load("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/water.jpg"); });
+            loading.add("tigger.png", [&]() { tiggerImage.load("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/tigger.png"); });
+            loading.add("tree.png", [&]() { barkImage.load("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/tree.png"); });
+            TaskGraph::Task balloonFile = loading.add("balloon.obj", [&]() {
+                balloonMesh = new Mesh("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/balloon.obj", false);
+            });
+            TaskGraph::Task tiggerFile = loading.add("tigger.obj", [&]() {
+                tigger = new Mesh("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/tigger.obj", false);
+            });
+            TaskGraph::Task treeFile = loading.add("tree.obj", [&]() {
+                treeMesh = new Mesh("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/tree.obj", false);
+            });
+            loading.depend(loading.add("balloon BVH", [&]() { balloonMesh->getBVH(); }), balloonFile);
+            loading.depend(loading.add("tigger BVH", [&]() { tigger->getBVH(); }), tiggerFile);
+            loading.depend(loading.add("tree BVH", [&]() { treeMesh->getBVH(); }), treeFile);
+            loading.run();
+        }
+        
+        TexturedMaterial* balloonSkin = new TexturedMaterial(balloonImage, GL_LINEAR);
         materials.push_back(balloonSkin);
         
-        Mesh* balloonMesh = new Mesh("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/balloon.obj");
+        balloonMesh->compile();
         meshes.push_back(balloonMesh);
         
         Material* red = new Material();
@@ -572,95 +1338,458 @@ public:
         purple->kd = float3(0.6, 0.2, 1);
 		materials.push_back(purple);
         
-		teapots.push_back((new Teapot(red))
-                          ->translate(float3(-90, 1, -40))
-                          ->scale(float3(1.5, 1.5, 1.5)) );
-		teapots.push_back((new Teapot(orange))
-                          ->translate(float3(-20, 1, 10))
-                          ->scale(float3(1.5, 1.5, 1.5)) );
-        teapots.push_back((new Teapot(yellow))
-                          ->translate(float3(40, 1, 70))
-                          ->scale(float3(1.5, 1.5, 1.5)) );
-		teapots.push_back((new Teapot(green))
-                          ->translate(float3(80, 1, -30))
-                          ->scale(float3(1.5, 1.5, 1.5)) );
-        teapots.push_back((new Teapot(blue))
-                          ->translate(float3(0, 1, -70))
-                          ->scale(float3(1.5, 1.5, 1.5)) );
-		teapots.push_back((new Teapot(purple))
-                          ->translate(float3(60, 1, 10))
-                          ->scale(float3(1.5, 1.5, 1.5)) );
+		addTeapot(red, float3(-90, 1, -40));
+		addTeapot(orange, float3(-20, 1, 10));
+        addTeapot(yellow, float3(40, 1, 70));
+		addTeapot(green, float3(80, 1, -30));
+        addTeapot(blue, float3(0, 1, -70));
+		addTeapot(purple, float3(60, 1, 10));
         NUM_TEAPOTS = teapots.size();
         
 
-        TexturedMaterial* sand = new TexturedMaterial("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/sand.jpg", GL_LINEAR);
+        TexturedMaterial* sand = new TexturedMaterial(sandImage, GL_LINEAR);
+        // the dunes are lit, so the sand must not be tinted
+        sand->kd = float3(1, 1, 1);
         materials.push_back(sand);
         
-        TexturedMaterial* water = new TexturedMaterial("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/water.jpg", GL_LINEAR);
+        TexturedMaterial* water = new TexturedMaterial(waterImage, GL_LINEAR);
         materials.push_back(water);
         
-        objects.push_back(new Ground(sand, float3(0,0,0), 100));
+        forward = new Shader(FORWARD_VERTEX_SHADER, (std::string(SHADING_FUNCTIONS) + SHADOW_FUNCTIONS + FORWARD_FRAGMENT_SHADER).c_str());
+        if(forward->isValid()) {
+            forward->use();
+            forward->set("uTexture", 0);
+            int shadowUnits[ShadowCascades::MAX_CASCADES];
+            for(int c = 0; c < ShadowCascades::MAX_CASCADES; c++)
+                shadowUnits[c] = SHADOW_UNIT + c;
+            forward->setArray1("uShadowMaps", shadowUnits, ShadowCascades::MAX_CASCADES);
+            forward->set("uLit", 1);
+            forward->set("uClusters", 2);
+            forward->set("uLightIndices", 3);
+            forward->set("uClusterLights", 4);
+            clusters = new LightClusters(*jobs);
+            
+            gbufferShader = new Shader(FORWARD_VERTEX_SHADER,
+                                       (std::string("#version 120\n") + SHADOW_FUNCTIONS + GBUFFER_FRAGMENT_SHADER).c_str());
+            deferred = new Shader(DEFERRED_VERTEX_SHADER, (std::string(SHADING_FUNCTIONS) + DEFERRED_FRAGMENT_SHADER).c_str());
+            gbuffer = new GBuffer();
+            if(gbufferShader->isValid() && deferred->isValid() && gbuffer->fitViewport()) {
+                gbufferShader->use();
+                gbufferShader->set("uTexture", 0);
+                gbufferShader->setArray1("uShadowMaps", shadowUnits, ShadowCascades::MAX_CASCADES);
+                gbufferShader->set("uLit", 1);
+                deferred->use();
+                deferred->set("uClusters", 2);
+                deferred->set("uLightIndices", 3);
+                deferred->set("uClusterLights", 4);
+                deferred->set("uAlbedo", 5 + GBuffer::ALBEDO);
+                deferred->set("uNormal", 5 + GBuffer::NORMAL);
+                deferred->set("uSpecular", 5 + GBuffer::SPECULAR);
+                deferred->set("uDepth", 5 + GBuffer::DEPTH);
+            } else {
+                fprintf(stderr, "deferred shading unavailable:\n%s%s%s\n",
+                        gbufferShader->getLog().c_str(), deferred->getLog().c_str(),
+                        gbuffer->fitViewport() ? "" : "G-buffer framebuffer incomplete\n");
+                delete gbufferShader;
+                delete deferred;
+                delete gbuffer;
+                gbufferShader = nullptr;
+                deferred = nullptr;
+                gbuffer = nullptr;
+            }
+            Shader::useFixedFunction();
+        } else {
+            fprintf(stderr, "forward shader unavailable, using fixed-function lighting:\n%s\n",
+                    forward->getLog().c_str());
+            delete forward;
+            forward = nullptr;
+        }
+        
+        occlusion = new OcclusionQueries();
+        
+        shadows = new ShadowCascades(3, 2048, 0.75);
+        shadows->setReuseFarCascade(true);
+        
+        // 512 units across, well past the island into the sea
+        terrain = new Terrain(16, 16, 2, islandHeight);
+        island = new Island(sand, terrain);
+        objects.push_back(island);
         
-        objects.push_back(new Ground(water, float3(300,0,0), 200));
-        objects.push_back(new Ground(water, float3(-300,0,0), 200));
-        objects.push_back(new Ground(water, float3(0,0,300), 200));
-        objects.push_back(new Ground(water, float3(0,0,-300), 200));
+        softwareOcclusion = new SoftwareOcclusion(*jobs);
+        std::vector<float3> shell;
+        terrain->getOccluder(8, shell);
+        island->getWorldMatrix().transformPoints(&shell[0], &shell[0], shell.size());
+        softwareOcclusion->addOccluders(shell);
+        // props on the island follow it
+        for(Object *t : teapots) {
+            const float3& p = t->getPosition();
+            t->setPosition(float3(p.x, terrain->heightAt(p.x, p.z) + 1, p.z));
+            t->attachTo(island);
+            Entity e = entities.create();
+            Transform transform = {t->getWorldPosition(), 0};
+            entities.transforms.add(e, transform);
+            Collectible collectible = {5};
+            entities.collectibles.add(e, collectible);
+            collectibleGrid.insert(e, transform.position, collectible.radius);
+            Renderable renderable = {t};
+            entities.renderables.add(e, renderable);
+        }
+        
+        // one sea all around; the island rises out of it
+        sea = new Ground(water, float3(0,0,0), 500);
+        objects.push_back(sea);
 
 
-        Mesh* tigger = new Mesh("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/tigger.obj");
+        tigger->compile();
         meshes.push_back(tigger);
         
-        TexturedMaterial* tiggerSkin = new TexturedMaterial("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/tigger.png", GL_LINEAR);
+        TexturedMaterial* tiggerSkin = new TexturedMaterial(tiggerImage, GL_LINEAR);
         materials.push_back(tiggerSkin);
         
-        player = new Avatar(1,tigger,tiggerSkin);
+        player = new MeshInstance(tigger,tiggerSkin);
         player->scale(float3(0.2,0.2,0.2));
         player->translate(float3(0,2,0));
         objects.push_back(player);
+        
+        playerEntity = entities.create();
+        Transform playerTransform = {player->getPosition(), 0};
+        Motion playerMotion = {float3(0,0,0), float3(0,0,0), 0, 0, 1, true};
+        entities.bodies.add(playerEntity, playerTransform, playerMotion);
+        Controller playerController = {10, 100, 10};
+        entities.controllers.add(playerEntity, playerController);
+        Renderable playerRenderable = {player};
+        entities.renderables.add(playerEntity, playerRenderable);
+        Collider playerCollider = Collider::sphere(float3(0,3,0), 1.5);
+        entities.addCollider(playerEntity, playerCollider);
+        
+        treeMesh->compile();
+        meshes.push_back(treeMesh);
+        
+        TexturedMaterial* bark = new TexturedMaterial(barkImage, GL_LINEAR);
+        materials.push_back(bark);
+        
+        // trees are obstacles: only their trunks are solid
+        float3 treeSpots[] = {
+            float3(-50,0,-70), float3(-60,0,40), float3(25,0,40),
+            float3(75,0,-70), float3(-10,0,-30) };
+        for(float3 spot : treeSpots) {
+            spot.y = groundHeight(spot.x, spot.z);
+            // the trunk, well inside the bark
+            softwareOcclusion->addOccluder(AABB(spot + float3(-0.4, 0, -0.4), spot + float3(0.4, 4, 0.4)));
+            Object* tree = new MeshInstance(treeMesh, bark);
+            tree->scale(float3(0.5,0.5,0.5));
+            tree->translate(spot);
+            objects.push_back(tree);
+            
+            Entity e = entities.create();
+            Transform treeTransform = {spot, 0};
+            entities.transforms.add(e, treeTransform);
+            Renderable treeRenderable = {tree};
+            entities.renderables.add(e, treeRenderable);
+            Collider trunk = Collider::box(float3(0,10,0), float3(1.5,10,1.5));
+            entities.addCollider(e, trunk);
+        }
+        
+        // a thousand warm lanterns, shown with 'l'
+        for(int i = 0; i < LightClusters::MAX_LIGHTS - 24; i++) {
+            Lantern l;
+            float r = 90 * sqrtf((float)rand() / RAND_MAX);
+            float a = 6.2832f * rand() / RAND_MAX;
+            l.center = float3(r * cosf(a), 0, r * sinf(a));
+            l.orbit = 2 + 8.0f * rand() / RAND_MAX;
+            l.speed = (0.2f + 0.6f * rand() / RAND_MAX) * (i % 2 ? 1 : -1);
+            l.phase = 6.2832f * rand() / RAND_MAX;
+            lanterns.push_back(l);
+            ClusteredLight light;
+            light.radius = 6;
+            light.power = float3(1, 0.6f + 0.2f * rand() / RAND_MAX, 0.25f) * 3;
+            lanternLights.push_back(light);
+        }
+        moveLanterns(0);
     }
     
-    void move(double t, double dt) {
-        for(Object *o : objects) {
-            o->move(t, dt);
+    // Only the forward shader lights the lanterns.
+    void toggleLanterns() {
+        lanternsOn = forward && !lanternsOn;
+    }
+    
+    void toggleDepthPrepass() {
+        depthPrepass = !depthPrepass;
+    }
+    
+    void toggleOcclusionCulling() {
+        occlusionCulling = !occlusionCulling;
+    }
+    
+    void toggleSoftwareCulling() {
+        softwareCulling = !softwareCulling;
+        // the buffer stops following the camera, so it must not be used
+        // when culling is turned back on
+        if(!softwareCulling)
+            softwareOcclusion->invalidate();
+    }
+    
+    // Starts drawing the occluders from where the camera was last frame, as a
+    // job, so that it overlaps the simulation. The culling decisions
+    // of the next frame are therefore one frame behind, like the queries'.
+    void beginSoftwareCulling() {
+        if(softwareCulling)
+            softwareOcclusion->renderAsync(camera.getProjMatrix() * camera.getViewMatrix());
+    }
+    
+    bool isSoftwareCulling() const {
+        return softwareCulling;
+    }
+    
+    SoftwareOcclusion::Stats getSoftwareCullingStats() const {
+        return softwareOcclusion->getStats();
+    }
+    
+    bool isOcclusionCulling() const {
+        return occlusionCulling;
+    }
+    
+    const OcclusionQueries::Stats& getOcclusionStats() const {
+        return occlusion->getStats();
+    }
+    
+    // Times the frame's parallel CPU work, lantern binning and the render
+    // list, with 1, 2, 4 and 8 threads, and prints the speedups. The
+    // simulation is left alone, so the game carries on where it was.
+    void benchmarkThreads() {
+        const int frames = 200;
+        finishSimulation();
+        softwareOcclusion->wait();
+        int threads = jobs->getThreadCount();
+        double single = 0;
+        printf("threads  ms/frame  speedup\n");
+        for(int n = 1; n <= 8; n *= 2) {
+            jobs->setThreadCount(n);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for(int f = 0; f < frames; f++) {
+                moveLanterns(f * 0.02);
+                if(clusters)
+                    clusters->bin(lanternLights, camera.getViewMatrix(), camera.getFov(), camera.getAspect(),
+                                  camera.getNearPlane(), camera.getFarPlane());
+                buildRenderList();
+            }
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count() / frames;
+            if(n == 1)
+                single = ms;
+            printf("%7d  %8.3f  %7.2f\n", n, ms, single / ms);
         }
+        jobs->setThreadCount(threads);
     }
     
-    void control(std::vector<bool>& keysPressed)
-    {
-        std::vector<Object*> spawn;
-        for (unsigned int iObject=0; iObject<objects.size(); iObject++)
-            objects.at(iObject)->control(keysPressed, spawn, objects);
-        for (unsigned int iTeapot=0; iTeapot<teapots.size(); iTeapot++)
-            teapots.at(iTeapot)->control(keysPressed, spawn, teapots);
-    }
-    
-    int collide() {
-        for (unsigned int iTeapot=0; iTeapot<teapots.size(); iTeapot++){
-            float dist = sqrt((pow(teapots.at(iTeapot)->position.x - player->position.x, 2)) +
-                              (pow(teapots.at(iTeapot)->position.z - player->position.z, 2)));
-            if(dist < 5) {
-                return iTeapot;
+    // Switches between forward and deferred shading, where both exist.
+    void toggleDeferred() {
+        deferredOn = deferred && !deferredOn;
+    }
+    
+    void moveLanterns(double t) {
+        jobs->parallelFor((int)lanterns.size(), 128, [&](int begin, int end) {
+            for(int i = begin; i < end; i++) {
+                const Lantern& l = lanterns[i];
+                float a = l.phase + l.speed * t;
+                float3 p = l.center + float3(cosf(a), 0, sinf(a)) * l.orbit;
+                p.y = terrain->heightAt(p.x, p.z) + 1.5f + 0.5f * sinf(a * 3);
+                lanternLights[i].position = p;
             }
+        }, "lantern orbits");
+    }
+    
+    void buildStepGraph() {
+        stepGraph = new TaskGraph(*jobs);
+        TaskGraph::Task motion = stepGraph->add("motion", [this]() {
+            // bodies are integrated in batches of whole SIMD groups
+            stepGraph->spawnFor("bodies", (int)entities.bodies.size(), 256, [this](int begin, int end) {
+                motionSystem(entities, stepDt, begin, end);
+                groundSystem(entities, *terrain, begin, end);
+            });
+        });
+        TaskGraph::Task sweep = stepGraph->add("sweep", [this]() {
+            continuousCollisionSystem(entities, sweepCandidates);
+        });
+        TaskGraph::Task collide = stepGraph->add("collision", [this]() {
+            PROFILE_ZONE("collisionSystem");
+            collisionStats = collisionSystem(entities, collisionPairs);
+        });
+        stepGraph->depend(sweep, motion);
+        stepGraph->depend(collide, sweep);
+    }
+    
+    void move(double dt) {
+        PROFILE_ZONE("Scene::move");
+        stepDt = dt;
+        stepGraph->run();
+    }
+    
+    // Runs steps as a job; finishSimulation() before touching the entity
+    // world from elsewhere.
+    void startSimulation(const JobSystem::Job& steps) {
+        jobs->run(steps, simulating, "simulation");
+    }
+    
+    void finishSimulation() {
+        jobs->wait(simulating);
+    }
+    
+    // What the steps change, to go back to after trying them out.
+    struct SimulationState {
+        EntityWorld entities;
+        SpatialHash collectibleGrid;
+    };
+    
+    SimulationState saveSimulation() const {
+        SimulationState state = {entities, collectibleGrid};
+        return state;
+    }
+    
+    void restoreSimulation(const SimulationState& state) {
+        entities = state.entities;
+        collectibleGrid = state.collectibleGrid;
+    }
+    
+    const Bodies& getBodies() const {
+        return entities.bodies;
+    }
+    
+    // The calling thread's arena, for lists needed until the frame is over.
+    FrameArena& getArena() {
+        return jobs->getArena();
+    }
+    
+    // Between frames, with the simulation finished.
+    void resetArenas() {
+        jobs->resetArenas();
+    }
+    
+    // Records the jobs of the next frames, then writes them to trace.json.
+    void traceFrames(int frames) {
+        finishSimulation();
+        tracedFrames = frames;
+        jobs->startTrace();
+    }
+    
+    void endFrame() {
+        if(tracedFrames == 0 || --tracedFrames > 0) return;
+        if(jobs->writeTrace("trace.json"))
+            printf("job trace written to trace.json\n");
+        else
+            fprintf(stderr, "cannot write trace.json\n");
+    }
+    
+    // visual only, so once per frame rather than per step
+    void animate(double t) {
+        if(lanternsOn)
+            moveLanterns(t);
+    }
+    
+    // Places the drawn objects alpha of the way from the previous simulation
+    // step to the current one. Only simulated bodies change their transforms.
+    void interpolate(double alpha) {
+        drawnCollisionStats = collisionStats;
+        const Bodies& bodies = entities.bodies;
+        for (size_t i = 0; i < bodies.size(); i++) {
+            Object* o = entities.renderables.get(bodies.ownerAt(i)).object;
+            o->setPosition(float3::lerp(bodies.previousPosition(i), bodies.position(i), alpha));
+            o->setOrientationAngle(bodies.previousAngle[i] + (bodies.angle[i] - bodies.previousAngle[i]) * alpha);
+        }
+    }
+    
+    void control(const std::vector<bool>& keysPressed)
+    {
+        PROFILE_ZONE("Scene::control");
+        controlSystem(entities, keysPressed);
+    }
+    
+    // appends every collectible the player is touching to collided
+    void collide(FrameVector<Entity>& collided) {
+        PROFILE_ZONE("Scene::collide");
+        // nothing to pick up once Tigger has left the ground
+        if(!entities.bodies.has(playerEntity)) return;
+        collectibleSystem(entities, collectibleGrid, playerEntity, collided);
+    }
+    
+    // Removes a picked up collectible from the simulation. Returns a handle
+    // to its teapot, for removeTeapot() once drawing allows.
+    TeapotHandle collect(Entity e) {
+        collectibleGrid.remove(e, entities.transforms.get(e).position);
+        Teapot* teapot = static_cast<Teapot*>(entities.renderables.get(e).object);
+        entities.destroy(e);
+        return teapots.handleOf(teapot);
+    }
+    
+    // Takes a collected teapot off the island and destroys it. False if it
+    // was gone already.
+    bool removeTeapot(TeapotHandle handle) {
+        Teapot* teapot = teapots.get(handle);
+        if(!teapot)
+            return false;
+        if(picked == teapot)
+            picked = nullptr;
+        // a teapot made later may get its address
+        occlusion->forget(teapot);
+        // its destructor detaches it from the island
+        teapots.destroy(handle);
+        return true;
+    }
+    
+    // A CPU-bound stress scene: count small teapots bouncing around the
+    // island, colliding with Tigger, the trees and each other.
+    void addStressBodies(int count) {
+        finishSimulation();
+        for(int i = 0; i < count; i++) {
+            Teapot* teapot = stressTeapots.get(stressTeapots.create(materials.at(rand() % materials.size())));
+            Object* o = teapot->scale(float3(0.3, 0.3, 0.3));
+            float x = 180.0f * rand() / RAND_MAX - 90;
+            float z = 180.0f * rand() / RAND_MAX - 90;
+            o->setPosition(float3(x, terrain->heightAt(x, z) + 2 + 8.0f * rand() / RAND_MAX, z));
+            
+            Entity e = entities.create();
+            Transform transform = {o->getPosition(), 0};
+            float3 velocity(20.0f * rand() / RAND_MAX - 10, 0, 20.0f * rand() / RAND_MAX - 10);
+            Motion motion = {velocity, float3(0, -10, 0), 0, 0, 0.9f, true};
+            entities.bodies.add(e, transform, motion);
+            Renderable renderable = {o};
+            entities.renderables.add(e, renderable);
+            Collider collider = Collider::sphere(float3(0, 0, 0), 0.5f);
+            entities.addCollider(e, collider);
         }
-        return -1;
     }
     
     void endGame(double t, double dt) {
         if(!balloonDrawn) {
-            balloon = new Balloon(meshes.at(0),materials.at(0));
-            balloon->translate(float3(0,26,0));
+            balloon = new MeshInstance(meshes.at(0),materials.at(0));
+            balloon->translate(float3(0,terrain->heightAt(0,0) + 26,0));
             balloon->scale(float3(1,1.5,1));
             objects.push_back(balloon);
+            
+            balloonEntity = entities.create();
+            Transform balloonTransform = {balloon->getPosition(), 0};
+            Motion balloonMotion = {float3(0,0,0), float3(0,0,0), 0, 0, 0, false};
+            entities.bodies.add(balloonEntity, balloonTransform, balloonMotion);
+            Renderable balloonRenderable = {balloon};
+            entities.renderables.add(balloonEntity, balloonRenderable);
+            // the basket is solid
+            Collider basket = Collider::box(float3(0,-25,0), float3(3,2,3));
+            entities.addCollider(balloonEntity, basket);
             balloonDrawn = true;
         }
         
-        float dist = sqrt((pow(balloon->position.x - player->position.x, 2)) +
-                          (pow(balloon->position.z - player->position.z, 2)));
-        if(dist < 5) {
+        float dist = sqrt((pow(balloon->getPosition().x - player->getPosition().x, 2)) +
+                          (pow(balloon->getPosition().z - player->getPosition().z, 2)));
+        if(dist < 5 && !blastOff) {
             blastOff = true;
-            player->position = float3(0,balloon->position.y - 24,0);
-            player->velocity = float3(0,4,0);
-            balloon->velocity = float3(0,4,0);
+            // Tigger climbs into the basket and rides the balloon from now on
+            player->setPosition(float3(0,balloon->getPosition().y - 24,0));
+            player->attachTo(balloon);
+            // the balloon carries Tigger from now on
+            entities.bodies.remove(playerEntity);
+            entities.controllers.remove(playerEntity);
+            entities.removeCollider(playerEntity);
+            entities.bodies.setVelocity(entities.bodies.slot(balloonEntity), float3(0,4,0));
             getCamera().eye = float3(15,3,0);
             getCamera().ahead = float3(-15, 30, 0);
         }
@@ -679,8 +1808,175 @@ Scene scene;
 //global
 std::vector<bool> keysPressed;
 
+// whether the profiler's overlay is shown, switched with 'f'
+bool showProfile = false;
+
+// whether the next frame is simulated while this one is drawn
+bool pipelined = true;
+// set by 'c', for the next frame to run the simulation checks
+bool checkRequested = false;
+// frames drawn since pipelining was last switched, to compare frame times
+int framesDrawn = 0;
+double framesStart = 0;
+
+void togglePipelining() {
+    double now = glutGet(GLUT_ELAPSED_TIME) * 0.001;
+    if(framesDrawn > 0)
+        printf("%s: %.2f ms per frame over %d frames\n", pipelined ? "pipelined" : "serial",
+               (now - framesStart) * 1000 / framesDrawn, framesDrawn);
+    pipelined = !pipelined;
+    framesDrawn = 0;
+    framesStart = now;
+}
+
+// Spawns and despawns COUNT teapots over and over for a second, first in a
+// pool and then with new and delete, and prints how many went by per second.
+// They are despawned in random order, as collectibles are picked up.
+void benchmarkPool() {
+    const int COUNT = 100000;
+    std::vector<int> order(COUNT);
+    for(int i = 0; i < COUNT; i++)
+        order[i] = i;
+    std::mt19937 random(1);
+    std::shuffle(order.begin(), order.end(), random);
+    
+    Pool<Teapot> pool;
+    std::vector<TeapotHandle> handles(COUNT);
+    int rounds = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    while(seconds < 1) {
+        for(int i = 0; i < COUNT; i++)
+            handles[i] = pool.create(nullptr);
+        for(int i = 0; i < COUNT; i++)
+            pool.destroy(handles[order[i]]);
+        rounds++;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    double pooled = rounds * COUNT / seconds;
+    int resolved = 0;
+    for(int i = 0; i < COUNT; i++)
+        if(pool.get(handles[i]))
+            resolved++;
+    
+    std::vector<Teapot*> teapots(COUNT);
+    rounds = 0;
+    start = std::chrono::steady_clock::now();
+    seconds = 0;
+    while(seconds < 1) {
+        for(int i = 0; i < COUNT; i++)
+            teapots[i] = new Teapot(nullptr);
+        for(int i = 0; i < COUNT; i++)
+            delete teapots[order[i]];
+        rounds++;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    double allocated = rounds * COUNT / seconds;
+    printf("teapots spawned and despawned per second: pool %.0f, new/delete %.0f; %d stale handles resolved\n",
+           pooled, allocated, resolved);
+}
+
+// benchmark results are stored here, so that the work is not optimized away
+volatile float benchmarkSink;
+
+// parents for the hierarchies benchmarkHierarchy() builds; node 0 is the root
+int wideParent(int) {
+    return 0;
+}
+int deepParent(int i) {
+    return (i - 1) % 500 == 0 ? 0 : i - 1;
+}
+int balancedParent(int i) {
+    return (i - 1) / 4;
+}
+
+// Builds hierarchies of 20000 teapots, all under one root, in chains of 500,
+// and four children to a node, then times bringing every world matrix up to
+// date: after moving the root, which dirties them all, and after moving a
+// single leaf, which the lazy update keeps to that leaf.
+void benchmarkHierarchy() {
+    const int NODES = 20000;
+    const int UPDATES = 20;
+    struct Shape {
+        const char* name;
+        int (*parentOf)(int);
+    };
+    Shape shapes[] = {{"wide", wideParent}, {"deep", deepParent}, {"balanced", balancedParent}};
+    printf("hierarchy of %d  ms/update: moved root  moved leaf\n", NODES);
+    for(const Shape& shape : shapes) {
+        // the root goes first, so that its children need not leave it one by one
+        Pool<Teapot> pool;
+        std::vector<Teapot*> nodes(NODES);
+        for(int i = 0; i < NODES; i++) {
+            nodes[i] = pool.get(pool.create(nullptr));
+            nodes[i]->setPosition(float3(1, 0, 0));
+            if(i > 0)
+                nodes[i]->attachTo(nodes[shape.parentOf(i)]);
+        }
+        double ms[2];
+        for(int leaf = 0; leaf < 2; leaf++) {
+            Object* moved = leaf ? nodes[NODES - 1] : nodes[0];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for(int u = 0; u < UPDATES; u++) {
+                moved->setPosition(float3((float)u, 0, 0));
+                float sum = 0;
+                for(int i = 0; i < NODES; i++)
+                    sum += nodes[i]->getWorldMatrix().data()[12];
+                benchmarkSink = sum;
+            }
+            ms[leaf] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / UPDATES;
+        }
+        printf("%-16s %20.3f %11.3f\n", shape.name, ms[0], ms[1]);
+    }
+}
+
+// Everything the 'b' key times; each benchmark prints a table of its own.
+void runBenchmarks() {
+    scene.benchmarkThreads();
+    {
+        Mesh tigger("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/tigger.obj", false);
+        std::vector<float3> vertices;
+        tigger.getTriangles(vertices);
+        benchmarkMath(vertices);
+    }
+    {
+        Mesh tree("/Users/emeersman/Documents/AIT/Graphics/OpenGL Rendering/OpenGL Rendering/smoothtree.obj", false);
+        std::vector<float3> vertices;
+        tree.getTriangles(vertices);
+        benchmarkRays(vertices);
+    }
+    benchmarkHierarchy();
+    benchmarkEntities();
+    benchmarkCollectibles();
+    benchmarkIntegration();
+    benchmarkCollisions();
+    benchmarkPool();
+}
+
 void onKeyboard(unsigned char key, int x, int y) {
     keysPressed.at(key) = true;
+    if(key == 'l')
+        scene.toggleLanterns();
+    if(key == 'g')
+        scene.toggleDeferred();
+    if(key == 'z')
+        scene.toggleDepthPrepass();
+    if(key == 'o')
+        scene.toggleOcclusionCulling();
+    if(key == 'h')
+        scene.toggleSoftwareCulling();
+    if(key == 'b')
+        runBenchmarks();
+    if(key == 't')
+        scene.traceFrames(60);
+    if(key == 'p')
+        togglePipelining();
+    if(key == 'x')
+        scene.addStressBodies(1000);
+    if(key == 'f')
+        showProfile = !showProfile;
+    if(key == 'c')
+        checkRequested = true;
 }
 
 void onKeyboardUp(unsigned char key, int x, int y) {
@@ -688,11 +1984,14 @@ void onKeyboardUp(unsigned char key, int x, int y) {
 }
 
 void onMouse(int button, int state, int x, int y) {
-    if(button == GLUT_LEFT_BUTTON)
+    if(button == GLUT_LEFT_BUTTON) {
         if(state == GLUT_DOWN)
             scene.getCamera().startDrag(x, y);
         else
             scene.getCamera().endDrag();
+    }
+    if(button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN)
+        scene.pick(x, y);
 }
 
 void onMouseMotion(int x, int y) {
@@ -705,46 +2004,301 @@ void onReshape(int winWidth, int winHeight) {
                                      (float)winWidth/winHeight);
 }
 
+void drawText(int x, int y, const char* text) {
+    glRasterPos2i(x, y);
+    for(const char* c = text; *c; c++)
+        glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+}
+
+// Where the frame time goes: every profiler zone averaged over the last
+// frames, and what the shadows, the terrain and the collisions cost.
+void drawProfile() {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, viewport[2], 0, viewport[3]);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    
+    char line[128];
+    int y = viewport[3] - 16;
+    glColor3f(1, 1, 0.6f);
+    std::vector<const Profiler::Zone*> zones = Profiler::getZones();
+    for(const Profiler::Zone* zone : zones) {
+        snprintf(line, sizeof(line), "%-20s %s %7.2f ms", zone->name, zone->gpu ? "GPU" : "CPU", zone->average());
+        drawText(8, y, line);
+        y -= 14;
+    }
+    snprintf(line, sizeof(line), "heap allocations: %.1f per frame", Profiler::averageAllocations());
+    drawText(8, y, line);
+    y -= 20;
+    const CollisionStats& collisions = scene.getCollisionStats();
+    snprintf(line, sizeof(line), "collision: %u proxies, %u pairs, %u contacts",
+             (unsigned int)collisions.proxies, (unsigned int)collisions.pairs, (unsigned int)collisions.contacts);
+    drawText(8, y, line);
+    y -= 14;
+    snprintf(line, sizeof(line), "terrain: %u triangles", scene.getTerrainTriangles());
+    drawText(8, y, line);
+    y -= 14;
+    const ShadowCascades& shadows = scene.getShadows();
+    for(int c = 0; c < shadows.getCount(); c++) {
+        const ShadowCascades::Stats& stats = shadows.getStats(c);
+        if(stats.reused)
+            snprintf(line, sizeof(line), "cascade %d: %.0f-%.0f m, reused", c, stats.nearDist, stats.farDist);
+        else
+            snprintf(line, sizeof(line), "cascade %d: %.0f-%.0f m, %u casters, %.2f ms", c,
+                     stats.nearDist, stats.farDist, stats.casters, stats.milliseconds);
+        drawText(8, y, line);
+        y -= 14;
+    }
+    
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
+
 // Displays the image.
 void onDisplay( ) {
     glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clear screen
     
 	scene.draw();
+    if(showProfile)
+        drawProfile();
     
-    glutSwapBuffers(); // drawing finished
+    // how many objects the occlusion culling kept back this frame
+    static char shownTitle[256];
+    char title[256] = "OpenGL teapots";
+    size_t length = strlen(title);
+    if(scene.isOcclusionCulling())
+        length += snprintf(title + length, sizeof(title) - length, " - queries: %u of %u occluded",
+                           scene.getOcclusionStats().occluded, scene.getOcclusionStats().tested);
+    if(scene.isSoftwareCulling()) {
+        const SoftwareOcclusion::Stats& stats = scene.getSoftwareCullingStats();
+        snprintf(title + length, sizeof(title) - length, " - CPU: %u of %u culled, %.1f + %.2f ms",
+                 stats.culled, stats.tested, stats.renderMilliseconds, stats.testMilliseconds);
+    }
+    if(strcmp(title, shownTitle) != 0) {
+        glutSetWindowTitle(title);
+        strcpy(shownTitle, title);
+    }
+    
+    {
+        PROFILE_ZONE("swap buffers");
+        glutSwapBuffers(); // drawing finished
+    }
+    scene.endFrame();
+    Profiler::endFrame();
+    framesDrawn++;
 }
 
 int score;
 
-void onIdle() {
-    double t = glutGet(GLUT_ELAPSED_TIME) * 0.001;
-    static double lastTime = 0.0;
-    double dt = t - lastTime;
-    lastTime = t;
-    
-    scene.control(keysPressed);
-    scene.move(t, dt);
+// The simulation advances in fixed steps so that it behaves the same at any
+// frame rate; rendering interpolates between the last two steps.
+const double SIM_DT = 1.0 / 120.0;
+// longest stretch of real time simulated in one frame, so a hitch cannot
+// make us fall further and further behind
+const double MAX_FRAME_TIME = 0.25;
+
+// The simulation runs a frame ahead of drawing: the steps of the next frame
+// run as a job while GLUT draws this one. They read stepKeys, not
+// keysPressed, which GLUT changes meanwhile, and leave their collected
+// teapots in collected; the drawn objects catch up with the entity world in
+// applySteps(), on the main thread, once they are done.
+std::vector<bool> stepKeys;
+std::vector<TeapotHandle> collected;
+double stepAlpha = 0;
+double simTime = 0.0;
+
+// one step of the entity world
+void simulate(double dt) {
+    scene.control(stepKeys);
+    scene.move(dt);
     
-    int collided = scene.collide();
-    if(collided != -1) {
-        scene.teapots.erase(scene.teapots.begin() + collided);
-        ++score;
-    }
+    FrameVector<Entity> collided(scene.getArena());
+    scene.collide(collided);
+    for(Entity e : collided)
+        collected.push_back(scene.collect(e));
+}
+
+void applySteps(double dt) {
+    for(TeapotHandle teapot : collected)
+        if(scene.removeTeapot(teapot))
+            ++score;
+    collected.clear();
     
     if(score == NUM_TEAPOTS) {
         gameWon = true;
     }
     
     if(gameWon) {
-        scene.endGame(t,dt);
+        scene.endGame(simTime,dt);
+    }
+    scene.interpolate(stepAlpha);
+    scene.animate(simTime);
+}
+
+// Adds a frame of dt seconds to the time not yet simulated and takes as
+// many whole steps off it as it holds; returns how many.
+int takeSteps(double& accumulator, double dt) {
+    accumulator += dt < MAX_FRAME_TIME ? dt : MAX_FRAME_TIME;
+    int steps = 0;
+    for(; accumulator >= SIM_DT; accumulator -= SIM_DT)
+        steps++;
+    return steps;
+}
+
+// Takes one half-second step, of the kind a long hitch could cause, with a body
+// heading fast at a tree trunk and with one heading at an island wall, and
+// checks that the sweep stops both on the near side instead of tunnelling.
+void checkSweeps() {
+    const double DT = 0.5;
+    const float RADIUS = 1.5f;
+    const float TRUNK = 1.5f;
+    EntityWorld world;
+    Entity tree = world.create();
+    Transform treeTransform = {float3(0, 0, 0), 0};
+    world.transforms.add(tree, treeTransform);
+    world.addCollider(tree, Collider::box(float3(0, 10, 0), float3(TRUNK, 10, TRUNK)));
+    
+    // 100 m in the step, starting 20 m short of the trunk and 9 m short of the wall
+    float3 starts[2] = {float3(-20, 1, 0), float3(ISLAND_EXTENT - 9, 1, 50)};
+    Entity bodies[2];
+    for(int k = 0; k < 2; k++) {
+        bodies[k] = world.create();
+        Transform transform = {starts[k], 0};
+        Motion motion = {float3(200, 0, 0), float3(0, 0, 0), 0, 0, 1, true};
+        world.bodies.add(bodies[k], transform, motion);
+        world.addCollider(bodies[k], Collider::sphere(float3(0, 3, 0), RADIUS));
+    }
+    
+    std::vector<Entity> candidates;
+    motionSystem(world, DT);
+    continuousCollisionSystem(world, candidates);
+    
+    float atTrunk = world.positionOf(bodies[0]).x;
+    float atWall = world.positionOf(bodies[1]).x;
+    bool passed = atTrunk + RADIUS <= -TRUNK + 1e-3f && atWall <= ISLAND_EXTENT + 1e-3f;
+    printf("sweeps: stopped at x = %.3f before the trunk at %.1f, at x = %.3f before the wall at %.0f: %s\n",
+           atTrunk, -TRUNK - RADIUS, atWall, ISLAND_EXTENT, passed ? "PASSED" : "FAILED");
+}
+
+// Simulates the same second from the current state twice, in frames of 1/60 s
+// and in frames of random length, with Tigger running in circles, and
+// compares where every body ends up. Fixed steps make the frame rate
+// irrelevant, so they must match exactly. The game is put back as it was.
+void checkDeterminism() {
+    const double DURATION = 1.0 + SIM_DT / 2;   // half a step over, so rounding cannot drop the last one
+    Scene::SimulationState start = scene.saveSimulation();
+    std::vector<bool> keys = stepKeys;
+    size_t collectedBefore = collected.size();
+    stepKeys.assign(256, false);
+    stepKeys['w'] = true;
+    stepKeys['a'] = true;
+    
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> frameTime(0.002, 0.05);
+    std::vector<double> frames[2];
+    for(int run = 0; run < 2; run++) {
+        double left = DURATION;
+        while(left > 0) {
+            double dt = run == 0 ? 1.0 / 60 : frameTime(random);
+            frames[run].push_back(dt < left ? dt : left);
+            left -= dt;
+        }
     }
     
-    float3 loc = player->position;
-    float rot = player->orientationAngle;
+    std::vector<float3> ends[2];
+    int steps[2] = {0, 0};
+    for(int run = 0; run < 2; run++) {
+        scene.restoreSimulation(start);
+        double accumulator = 0.0;
+        for(double dt : frames[run]) {
+            int n = takeSteps(accumulator, dt);
+            for(int i = 0; i < n; i++)
+                simulate(SIM_DT);
+            steps[run] += n;
+        }
+        const Bodies& bodies = scene.getBodies();
+        for(size_t i = 0; i < bodies.size(); i++)
+            ends[run].push_back(bodies.position(i));
+    }
+    
+    size_t mismatches = 0;
+    for(size_t i = 0; i < ends[0].size() && i < ends[1].size(); i++)
+        if(ends[0][i].x != ends[1][i].x || ends[0][i].y != ends[1][i].y || ends[0][i].z != ends[1][i].z)
+            mismatches++;
+    bool passed = steps[0] == steps[1] && ends[0].size() == ends[1].size() && mismatches == 0;
+    printf("determinism: %d and %d steps in %u and %u frames, %u bodies, %u differ: %s\n",
+           steps[0], steps[1], (unsigned int)frames[0].size(), (unsigned int)frames[1].size(),
+           (unsigned int)ends[0].size(), (unsigned int)mismatches, passed ? "PASSED" : "FAILED");
+    
+    scene.restoreSimulation(start);
+    stepKeys = keys;
+    collected.resize(collectedBefore);
+}
+
+// Simulates dt more seconds, in fixed steps, and readies the scene for
+// drawing.
+void advance(double dt) {
+    static double accumulator = 0.0;
+    
+    scene.finishSimulation();
+    if(checkRequested) {
+        checkDeterminism();
+        checkSweeps();
+        checkRequested = false;
+    }
+    scene.resetArenas();
+    if(pipelined)
+        applySteps(dt);
+    scene.beginSoftwareCulling();
+    int steps = takeSteps(accumulator, dt);
+    stepAlpha = accumulator / SIM_DT;
+    stepKeys = keysPressed;
+    simTime += steps * SIM_DT;
+    
+    auto run = [steps]() {
+        for(int i = 0; i < steps; i++)
+            simulate(SIM_DT);
+    };
+    if(pipelined) {
+        scene.startSimulation(run);
+    } else {
+        run();
+        applySteps(dt);
+    }
+    
+    float3 loc = player->getPosition();
+    float rot = player->getOrientationAngle();
     if(!blastOff){
         scene.getCamera().move(loc, rot, dt, keysPressed);
     }
+}
+
+// GLUT leaves its main loop by exiting
+void writeProfile() {
+    if(Profiler::writeReport("profile.txt"))
+        printf("profile written to profile.txt\n");
+}
+
+void onIdle() {
+    double t = glutGet(GLUT_ELAPSED_TIME) * 0.001;
+    static double lastTime = t;
+    double dt = t - lastTime;
+    lastTime = t;
+    
+    advance(dt);
     glutPostRedisplay();
 }
 
@@ -778,6 +2332,7 @@ int main(int argc, char **argv) {
     
     
     scene.initialize();
+    atexit(writeProfile);
     
     glutMainLoop();								// launch event handling loop
     
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "float3.h"
+#include "float4x4.h"
+
+// Unit quaternion for orientations. (x, y, z) is the vector part, w the scalar part.
+class alignas(16) quaternion
+{
+public:
+	float x;
+	float y;
+	float z;
+	float w;
+
+	constexpr quaternion():x(0),y(0),z(0),w(1){}
+
+	constexpr quaternion(float x, float y, float z, float w):x(x),y(y),z(z),w(w){}
+
+	// angle in degrees, to match Object::rotate and glRotatef
+	static quaternion fromAxisAngle(const float3& axis, float angle)
+	{
+		float3 a = axis.normalized();
+		float half = angle * (float)(M_PI / 360.0);
+		float s = sinf(half);
+		return quaternion(a.x * s, a.y * s, a.z * s, cosf(half));
+	}
+
+	quaternion operator*(const quaternion& q) const
+	{
+		return quaternion(
+			w*q.x + x*q.w + y*q.z - z*q.y,
+			w*q.y - x*q.z + y*q.w + z*q.x,
+			w*q.z + x*q.y - y*q.x + z*q.w,
+			w*q.w - x*q.x - y*q.y - z*q.z);
+	}
+
+	quaternion conjugate() const
+	{
+		return quaternion(-x, -y, -z, w);
+	}
+
+	float dot(const quaternion& q) const
+	{
+		return x*q.x + y*q.y + z*q.z + w*q.w;
+	}
+
+	quaternion normalized() const
+	{
+		float oneOverLength = 1.0f / sqrtf(dot(*this));
+		return quaternion(x * oneOverLength, y * oneOverLength, z * oneOverLength, w * oneOverLength);
+	}
+
+	float3 rotate(const float3& v) const
+	{
+		// v' = v + 2w(u x v) + 2u x (u x v)
+		float3 u(x, y, z);
+		float3 t = u.cross(v) * 2.0f;
+		return v + t * w + u.cross(t);
+	}
+
+	float4x4 toMatrix() const
+	{
+		return float4x4(
+			1 - 2*(y*y + z*z), 2*(x*y - z*w),     2*(x*z + y*w),     0,
+			2*(x*y + z*w),     1 - 2*(x*x + z*z), 2*(y*z - x*w),     0,
+			2*(x*z - y*w),     2*(y*z + x*w),     1 - 2*(x*x + y*y), 0,
+			0, 0, 0, 1);
+	}
+
+	// normalized linear interpolation along the shorter arc
+	static quaternion nlerp(const quaternion& a, const quaternion& b, float t)
+	{
+		float sign = a.dot(b) < 0 ? -1.0f : 1.0f;
+		return quaternion(
+			a.x + (b.x * sign - a.x) * t,
+			a.y + (b.y * sign - a.y) * t,
+			a.z + (b.z * sign - a.z) * t,
+			a.w + (b.w * sign - a.w) * t).normalized();
+	}
+
+	static quaternion slerp(const quaternion& a, const quaternion& b, float t)
+	{
+		float cosTheta = a.dot(b);
+		float sign = 1.0f;
+		if(cosTheta < 0)
+		{
+			cosTheta = -cosTheta;
+			sign = -1.0f;
+		}
+		if(cosTheta > 0.9995f)
+			return nlerp(a, b, t);
+		float theta = acosf(cosTheta);
+		float oneOverSin = 1.0f / sinf(theta);
+		float wa = sinf((1 - t) * theta) * oneOverSin;
+		float wb = sinf(t * theta) * oneOverSin * sign;
+		return quaternion(
+			a.x * wa + b.x * wb,
+			a.y * wa + b.y * wb,
+			a.z * wa + b.z * wb,
+			a.w * wa + b.w * wb);
+	}
+};